@@ -25,6 +25,8 @@ LOCAL_SRC_FILES := \
 	src/sys.c \
 	src/cpu.c \
 	src/ppu.c \
+	src/ntsc.c \
+	src/debug.c \
 	src/retro.c
 
 include $(BUILD_SHARED_LIBRARY)
@@ -353,6 +353,7 @@ static void apu_dmc_step_timer(struct dmc *d, NES *nes)
 
 struct dac {
 	NES_Config cfg;
+	enum apu_mixer mixer;
 
 	int32_t pvol[31];
 	int32_t tndvol[203];
@@ -511,34 +512,40 @@ static void apu_dac_step(struct dac *dac, int32_t l, int32_t r)
 		apu_dac_generate_output(dac, offset);
 }
 
-static void apu_dac_mix(struct dac *dac, uint8_t p0, uint8_t p1, uint8_t p2, uint8_t p3,
-	uint8_t t, uint8_t n, uint8_t d, int32_t *ext)
+static FORCE_INLINE void apu_dac_mix(struct dac *dac, enum apu_mixer mixer, uint8_t p0, uint8_t p1,
+	uint8_t p2, uint8_t p3, uint8_t t, uint8_t n, uint8_t d, int32_t *ext)
 {
-	if (!(dac->cfg.channels & NES_CHANNEL_PULSE_0))
-		p0 = 0;
+	bool stereo = mixer == APU_MIX_STEREO;
 
-	if (!(dac->cfg.channels & NES_CHANNEL_PULSE_1))
-		p1 = 0;
+	if (mixer == APU_MIX_MASKED) {
+		stereo = dac->cfg.stereo;
 
-	if (!(dac->cfg.channels & NES_CHANNEL_TRIANGLE))
-		t = 0;
+		if (!(dac->cfg.channels & NES_CHANNEL_PULSE_0))
+			p0 = 0;
 
-	if (!(dac->cfg.channels & NES_CHANNEL_NOISE))
-		n = 0;
+		if (!(dac->cfg.channels & NES_CHANNEL_PULSE_1))
+			p1 = 0;
 
-	if (!(dac->cfg.channels & NES_CHANNEL_DMC))
-		d = 0;
+		if (!(dac->cfg.channels & NES_CHANNEL_TRIANGLE))
+			t = 0;
 
-	if (!(dac->cfg.channels & NES_CHANNEL_EXT_0))
-		ext[0] = p2 = 0;
+		if (!(dac->cfg.channels & NES_CHANNEL_NOISE))
+			n = 0;
 
-	if (!(dac->cfg.channels & NES_CHANNEL_EXT_1))
-		ext[1] = p3 = 0;
+		if (!(dac->cfg.channels & NES_CHANNEL_DMC))
+			d = 0;
 
-	if (!(dac->cfg.channels & NES_CHANNEL_EXT_2))
-		ext[2] = 0;
+		if (!(dac->cfg.channels & NES_CHANNEL_EXT_0))
+			ext[0] = p2 = 0;
 
-	if (dac->cfg.stereo) {
+		if (!(dac->cfg.channels & NES_CHANNEL_EXT_1))
+			ext[1] = p3 = 0;
+
+		if (!(dac->cfg.channels & NES_CHANNEL_EXT_2))
+			ext[2] = 0;
+	}
+
+	if (stereo) {
 		int32_t l = dac->tndvol[3 * t + 2 * n] + dac->pvol[p0] - dac->pvol[p2] + ext[0] + ext[2];
 		int32_t r = dac->tndvol[d] + dac->pvol[p1] - dac->pvol[p3] + ext[1];
 
@@ -551,7 +558,6 @@ static void apu_dac_mix(struct dac *dac, uint8_t p0, uint8_t p1, uint8_t p2, uin
 	}
 }
 
-
 // IO
 
 struct apu {
@@ -579,6 +585,12 @@ void apu_dma_dmc_finish(struct apu *apu, uint8_t v)
 	apu->d.reader.sample_buffer = v;
 }
 
+bool apu_dmc_idle(struct apu *apu)
+{
+	// No sample bytes left, DMC DMA can only restart with a write to $4015
+	return apu->d.current_length == 0;
+}
+
 static void apu_reload_length(struct apu *apu, struct length *len, bool channel_enabled, uint8_t v)
 {
 	bool in_length_cycle = apu->frame_counter == 14913 || apu->frame_counter == (apu->mode ? 37281 : 29828);
@@ -858,7 +870,7 @@ static void apu_step_frame_counter(struct apu *apu)
 	}
 }
 
-void apu_step(struct apu *apu, NES *nes)
+static FORCE_INLINE void apu_step_mixer(struct apu *apu, NES *nes, enum apu_mixer mixer)
 {
 	// Pulse & dmc step every other clock
 	if (sys_odd_cycle(nes)) {
@@ -898,12 +910,20 @@ void apu_step(struct apu *apu, NES *nes)
 	}
 
 	// Mix
-	apu_dac_mix(&apu->dac, apu->p[0].output, apu->p[1].output, apu->p[2].output,
+	apu_dac_mix(&apu->dac, mixer, apu->p[0].output, apu->p[1].output, apu->p[2].output,
 		apu->p[3].output, apu->t.output, apu->n.output, apu->d.output, apu->ext);
 
 	apu->frame_counter++;
 }
 
+#define APU_STEP(mixer, name) \
+	void name(struct apu *apu, NES *nes) \
+	{ \
+		apu_step_mixer(apu, nes, mixer); \
+	}
+
+APU_MIXERS(APU_STEP)
+
 void apu_assert_irqs(struct apu *apu, struct cpu *cpu)
 {
 	cpu_irq(cpu, IRQ_DMC, apu->d.irq_flag);
@@ -933,6 +953,8 @@ const int16_t *apu_pop_frames(struct apu *apu)
 void apu_set_config(struct apu *apu, const NES_Config *cfg)
 {
 	apu->dac.cfg = *cfg;
+	apu->dac.mixer = cfg->channels != NES_CHANNEL_ALL ? APU_MIX_MASKED :
+		cfg->stereo ? APU_MIX_STEREO : APU_MIX_MONO;
 
 	uint32_t clock = APU_CLOCK + (cfg->preNMI + cfg->postNMI) * (APU_CLOCK / 262);
 	apu->dac.factor = (uint32_t) ceil(TIME_UNIT * (double) cfg->sampleRate / (double) clock);
@@ -941,6 +963,11 @@ void apu_set_config(struct apu *apu, const NES_Config *cfg)
 	OC_SHIFT = (uint8_t) ((cfg->preNMI + cfg->postNMI) / 262);
 }
 
+enum apu_mixer apu_get_mixer(struct apu *apu)
+{
+	return apu->dac.mixer;
+}
+
 
 // Lifecycle
 
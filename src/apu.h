@@ -8,13 +8,28 @@
 
 struct apu;
 
+enum apu_mixer {
+	APU_MIX_MONO   = 0, // All channels, mono
+	APU_MIX_STEREO = 1, // All channels, stereo
+	APU_MIX_MASKED = 2, // Some channels muted
+};
+
+// Step instantiations, one per mixer so its configuration folds away
+#define APU_MIXERS(X) \
+	X(APU_MIX_MONO,   apu_step_mono) \
+	X(APU_MIX_STEREO, apu_step_stereo) \
+	X(APU_MIX_MASKED, apu_step_masked)
+
 // IO
 void apu_dma_dmc_finish(struct apu *apu, uint8_t v);
+bool apu_dmc_idle(struct apu *apu);
 uint8_t apu_read_status(struct apu *apu, bool extended);
 void apu_write(struct apu *apu, NES *nes, uint16_t addr, uint8_t v, bool extended);
 
 // Step
-void apu_step(struct apu *apu, NES *nes);
+void apu_step_mono(struct apu *apu, NES *nes);
+void apu_step_stereo(struct apu *apu, NES *nes);
+void apu_step_masked(struct apu *apu, NES *nes);
 void apu_assert_irqs(struct apu *apu, struct cpu *cpu);
 void apu_set_ext_output(struct apu *apu, uint8_t channel, int32_t output);
 uint32_t apu_num_frames(struct apu *apu);
@@ -22,6 +37,7 @@ const int16_t *apu_pop_frames(struct apu *apu);
 
 // Configuration
 void apu_set_config(struct apu *apu, const NES_Config *cfg);
+enum apu_mixer apu_get_mixer(struct apu *apu);
 
 // Lifecycle
 struct apu *apu_create(const NES_Config *cfg);
@@ -11,6 +11,10 @@
 	#define static_assert _Static_assert
 #endif
 
+// Mappers with cycle counted IRQs catch up lazily, their deadline is the number of
+// cycles after the last sync until the cycle that has to be stepped exactly
+#define DEADLINE_NONE UINT64_MAX
+
 #include "mapper/fcg.c"
 #include "mapper/fds.c"
 #include "mapper/fme7.c"
@@ -25,6 +29,96 @@
 #include "mapper/vrc6.c"
 #include "mapper/vrc7.c"
 
+// NULL members fall back to plain memory access or do nothing
+struct mapper_ops {
+	void (*create)(struct cart *cart);
+	uint8_t (*prg_read)(struct cart *cart, struct apu *apu, uint16_t addr, bool *mem_hit);
+	void (*prg_write)(struct cart *cart, struct apu *apu, uint16_t addr, uint8_t v);
+	uint8_t (*chr_read)(struct cart *cart, uint16_t addr, enum mem type);
+	uint8_t (*nt_read)(struct cart *cart, uint16_t addr, enum mem type, bool nt);
+	void (*step)(struct cart *cart, struct cpu *cpu, struct apu *apu);
+	void (*sync)(struct cart *cart, struct cpu *cpu, uint64_t cycles);
+	uint64_t (*deadline)(struct cart *cart);
+	void (*ppu_a12_toggle)(struct cart *cart);
+	void (*ppu_write_hook)(struct cart *cart, uint16_t addr, uint8_t v);
+	bool (*block_2007)(struct cart *cart);
+
+	// First address the mapper decodes as a register while work RAM stays mapped beneath it
+	uint16_t ram_regs;
+};
+
+#define MAPPER_OPS_GENERIC \
+	{.create = mapper_create, .prg_write = mapper_prg_write}
+
+static const struct mapper_ops MAPPER_OPS[256] = {
+	[0]   = MAPPER_OPS_GENERIC,
+	[1]   = {.create = mmc1_create, .prg_write = mmc1_prg_write},
+	[2]   = MAPPER_OPS_GENERIC,
+	[3]   = MAPPER_OPS_GENERIC,
+	[4]   = {.create = mmc3_create, .prg_read = mmc3_prg_read, .prg_write = mmc3_prg_write,
+		.step = mmc3_step, .ppu_a12_toggle = mmc3_ppu_a12_toggle},
+	[5]   = {.create = mmc5_create, .prg_read = mmc5_prg_read, .prg_write = mmc5_prg_write,
+		.chr_read = mmc5_chr_read, .nt_read = mmc5_nt_read_hook, .step = mmc5_step,
+		.ppu_write_hook = mmc5_ppu_write_hook},
+	[7]   = MAPPER_OPS_GENERIC,
+	[9]   = {.create = mmc2_create, .prg_write = mmc2_prg_write, .chr_read = mmc2_chr_read},
+	[10]  = {.create = mmc2_create, .prg_write = mmc2_prg_write, .chr_read = mmc2_chr_read},
+	[11]  = MAPPER_OPS_GENERIC,
+	[13]  = MAPPER_OPS_GENERIC,
+	[16]  = {.create = fcg_create, .prg_write = fcg_prg_write, .sync = fcg_sync,
+		.deadline = fcg_deadline},
+	[18]  = {.create = jaleco_create, .prg_write = jaleco_prg_write, .sync = jaleco_sync,
+		.deadline = jaleco_deadline},
+	[19]  = {.create = namco_create, .prg_read = namco_prg_read, .prg_write = namco_prg_write,
+		.sync = namco_sync, .deadline = namco_deadline},
+	[20]  = {.create = fds_create, .prg_read = fds_prg_read, .prg_write = fds_prg_write,
+		.step = fds_step},
+	[21]  = {.create = vrc2_4_create, .prg_read = vrc_prg_read, .prg_write = vrc_prg_write,
+		.sync = vrc_sync, .deadline = vrc_deadline},
+	[22]  = {.create = vrc2_4_create, .prg_read = vrc_prg_read, .prg_write = vrc_prg_write},
+	[23]  = {.create = vrc2_4_create, .prg_read = vrc_prg_read, .prg_write = vrc_prg_write,
+		.sync = vrc_sync, .deadline = vrc_deadline},
+	[24]  = {.create = vrc_create, .prg_write = vrc6_prg_write, .step = vrc6_step},
+	[25]  = {.create = vrc2_4_create, .prg_read = vrc_prg_read, .prg_write = vrc_prg_write,
+		.sync = vrc_sync, .deadline = vrc_deadline},
+	[26]  = {.create = vrc_create, .prg_write = vrc6_prg_write, .step = vrc6_step},
+	[30]  = MAPPER_OPS_GENERIC,
+	[31]  = MAPPER_OPS_GENERIC,
+	[34]  = {.create = mapper_create, .prg_write = mapper_prg_write, .ram_regs = 0x7FFD},
+	[38]  = MAPPER_OPS_GENERIC,
+	[66]  = MAPPER_OPS_GENERIC,
+	[69]  = {.create = fme7_create, .prg_write = fme7_prg_write, .step = fme7_step},
+	[70]  = MAPPER_OPS_GENERIC,
+	[71]  = MAPPER_OPS_GENERIC,
+	[77]  = MAPPER_OPS_GENERIC,
+	[78]  = MAPPER_OPS_GENERIC,
+	[79]  = MAPPER_OPS_GENERIC,
+	[85]  = {.create = vrc_create, .prg_write = vrc7_prg_write, .sync = vrc_sync,
+		.deadline = vrc_deadline},
+	[87]  = MAPPER_OPS_GENERIC,
+	[89]  = MAPPER_OPS_GENERIC,
+	[93]  = MAPPER_OPS_GENERIC,
+	[94]  = MAPPER_OPS_GENERIC,
+	[97]  = MAPPER_OPS_GENERIC,
+	[101] = MAPPER_OPS_GENERIC,
+	[107] = MAPPER_OPS_GENERIC,
+	[111] = MAPPER_OPS_GENERIC,
+	[113] = MAPPER_OPS_GENERIC,
+	[140] = MAPPER_OPS_GENERIC,
+	[145] = MAPPER_OPS_GENERIC,
+	[146] = MAPPER_OPS_GENERIC,
+	[148] = MAPPER_OPS_GENERIC,
+	[149] = MAPPER_OPS_GENERIC,
+	[152] = MAPPER_OPS_GENERIC,
+	[159] = {.create = fcg_create, .prg_write = fcg_prg_write, .sync = fcg_sync,
+		.deadline = fcg_deadline},
+	[180] = MAPPER_OPS_GENERIC,
+	[184] = MAPPER_OPS_GENERIC,
+	[185] = {.create = mapper_create, .prg_write = mapper_prg_write, .block_2007 = mapper_block_2007},
+	[206] = {.create = mmc3_create, .prg_write = mmc3_prg_write},
+	[210] = {.create = namco_create, .prg_write = namco_prg_write},
+};
+
 
 // Cart
 
@@ -66,6 +160,28 @@ struct cart {
 	uint8_t *ram;
 	size_t ram_size;
 
+	uint32_t bank_switches;
+	uint32_t chr_generation; // Changes whenever a PPU fetch could return something new
+
+	// Resolved base of each 1KB CHR slot so unhooked PPU reads are a single load,
+	// unmapped slots point at CHR_OPEN. Rebuilt from the map after set_state.
+	const uint8_t *chr_slots[16];
+	bool chr_hooked; // Reads go through the mapper (MMC2, MMC5)
+
+	// Points into MAPPER_OPS, kept from the live cart on set_state
+	const struct mapper_ops *ops;
+
+	// CPU cycle the mapper has caught up to and the next cycle that must be stepped
+	uint64_t synced;
+	uint64_t deadline;
+
+	// Decoded pattern rows for CHR-ROM and CHR-RAM, 8 pixels with one byte each
+	struct chr_cache {
+		uint64_t *rows;
+		uint8_t *dirty;
+		size_t num_rows;
+	} chr_cache[2];
+
 	uint8_t mapper[MAPPER_MAX];
 };
 
@@ -87,6 +203,21 @@ struct cart {
 #define map_is_ram(type) \
 	((type & 0x3) > 0)
 
+static const uint8_t CHR_OPEN[CHR_SLOT];
+
+static void cart_update_chr_slot(struct cart *ctx, uint8_t slot)
+{
+	struct map *m = &ctx->range[RANGE_CHR].map[0][slot];
+
+	ctx->chr_slots[slot] = m->mem ? m->mem->data + m->offset : CHR_OPEN;
+}
+
+static void cart_update_chr_slots(struct cart *ctx)
+{
+	for (uint8_t x = 0; x < 16; x++)
+		cart_update_chr_slot(ctx, x);
+}
+
 void cart_map(struct cart *ctx, enum mem type, uint16_t addr, uint16_t bank, uint8_t bank_size_kb)
 {
 	struct range *range = map_get_range(ctx, type);
@@ -98,13 +229,28 @@ void cart_map(struct cart *ctx, enum mem type, uint16_t addr, uint16_t bank, uin
 	int32_t bank_size_bytes = bank_size_kb * 0x0400;
 	int32_t bank_offset = bank * bank_size_bytes;
 	int32_t end_slot = start_slot + (bank_size_bytes >> range->shift);
+	bool changed = false;
 
 	for (int32_t x = start_slot, y = 0; x < end_slot; x++, y++) {
 		struct map *m = map_get_slot(range, type, x);
+		size_t offset = (bank_offset + (y << range->shift)) % mem->size;
+
+		changed = changed || m->type != type || m->mem != mem || m->offset != offset;
 
 		m->type = type;
 		m->mem = mem;
-		m->offset = (bank_offset + (y << range->shift)) % mem->size;
+		m->offset = offset;
+	}
+
+	if (changed) {
+		ctx->bank_switches++;
+
+		if (range == &ctx->range[RANGE_CHR]) {
+			ctx->chr_generation++;
+
+			for (int32_t x = start_slot; x < end_slot; x++)
+				cart_update_chr_slot(ctx, (uint8_t) x);
+		}
 	}
 }
 
@@ -114,6 +260,10 @@ void cart_unmap(struct cart *ctx, enum mem type, uint16_t addr)
 	struct map *m = map_get_slot_by_addr(range, type, addr);
 
 	memset(m, 0, sizeof(struct map));
+	ctx->chr_generation++;
+
+	if (range == &ctx->range[RANGE_CHR])
+		cart_update_chr_slot(ctx, addr >> CHR_SHIFT);
 }
 
 void cart_map_ciram_offset(struct cart *ctx, uint8_t dest, enum mem type, size_t offset)
@@ -123,6 +273,11 @@ void cart_map_ciram_offset(struct cart *ctx, uint8_t dest, enum mem type, size_t
 	if (mem->size == 0)
 		return;
 
+	struct map *m = &range->map[0][dest + 8];
+
+	if (m->type != type || m->mem != mem || m->offset != offset)
+		ctx->chr_generation++;
+
 	range->map[0][dest + 8].type = type;
 	range->map[0][dest + 8].mem = mem;
 	range->map[0][dest + 8].offset = offset;
@@ -131,7 +286,10 @@ void cart_map_ciram_offset(struct cart *ctx, uint8_t dest, enum mem type, size_t
 		range->map[0][dest + 12].type = type;
 		range->map[0][dest + 12].mem = mem;
 		range->map[0][dest + 12].offset = offset;
+		cart_update_chr_slot(ctx, dest + 12);
 	}
+
+	cart_update_chr_slot(ctx, dest + 8);
 }
 
 void cart_map_ciram_slot(struct cart *ctx, uint8_t dest, uint8_t src)
@@ -153,6 +311,9 @@ void cart_unmap_ciram(struct cart *ctx, uint8_t dest)
 
 	if (dest < 4)
 		memset(&range->map[0][dest + 12].mem, 0, sizeof(struct map));
+
+	ctx->chr_generation++;
+	cart_update_chr_slots(ctx);
 }
 
 
@@ -197,6 +358,53 @@ const NES_CartDesc *cart_get_desc(struct cart *ctx)
 	return &ctx->hdr;
 }
 
+uint32_t cart_get_chr_generation(struct cart *ctx)
+{
+	return ctx->chr_generation;
+}
+
+uint32_t cart_pop_bank_switches(struct cart *ctx)
+{
+	uint32_t r = ctx->bank_switches;
+	ctx->bank_switches = 0;
+
+	return r;
+}
+
+bool cart_get_offset(struct cart *ctx, enum mem type, uint16_t addr, enum mem *mem_type, size_t *offset)
+{
+	struct range *range = map_get_range(ctx, type);
+	struct map *m = map_get_slot_by_addr(range, type, addr);
+
+	if (!m->mem)
+		return false;
+
+	*mem_type = m->type;
+	*offset = m->offset + (addr & range->mask);
+
+	return true;
+}
+
+bool cart_prg_is_ram(struct cart *ctx, uint16_t addr)
+{
+	const struct map *m = &ctx->range[RANGE_PRG].map[0][addr >> PRG_SHIFT];
+
+	if (ctx->ops->ram_regs && addr >= ctx->ops->ram_regs && addr < 0x8000)
+		return false;
+
+	return m->mem && m->type == PRG_RAM;
+}
+
+
+// IRQ scheduling
+
+static void cart_update_deadline(struct cart *ctx)
+{
+	uint64_t deadline = ctx->ops->deadline ? ctx->ops->deadline(ctx) : DEADLINE_NONE;
+
+	ctx->deadline = deadline == DEADLINE_NONE ? DEADLINE_NONE : ctx->synced + deadline;
+}
+
 
 // IO
 
@@ -220,125 +428,174 @@ void cart_write(struct cart *ctx, enum mem type, uint16_t addr, uint8_t v)
 	struct range *range = map_get_range(ctx, type);
 	struct map *m = map_get_slot_by_addr(range, type, addr);
 
-	if (m->mem && map_is_ram(m->type))
-		m->mem->data[m->offset + (addr & range->mask)] = v;
+	if (m->mem && map_is_ram(m->type)) {
+		size_t offset = m->offset + (addr & range->mask);
+		m->mem->data[offset] = v;
+
+		if (range == &ctx->range[RANGE_CHR]) {
+			ctx->chr_generation++;
+
+			if (m->type == CHR_RAM && ctx->chr_cache[MEM_RAM].dirty)
+				ctx->chr_cache[MEM_RAM].dirty[((offset >> 4) << 3) | (offset & 0x07)] = 1;
+		}
+	}
 }
 
 uint8_t cart_prg_read(struct cart *cart, struct apu *apu, uint16_t addr, bool *mem_hit)
 {
-	switch (cart->hdr.mapper) {
-		case 4:  return mmc3_prg_read(cart, addr, mem_hit);
-		case 5:  return mmc5_prg_read(cart, apu, addr, mem_hit);
-		case 19: return namco_prg_read(cart, addr, mem_hit);
-		case 20: return fds_prg_read(cart, addr, mem_hit);
-		case 21:
-		case 22:
-		case 23:
-		case 25: return vrc_prg_read(cart, addr, mem_hit);
-	}
+	if (cart->ops->prg_read)
+		return cart->ops->prg_read(cart, apu, addr, mem_hit);
 
 	return cart_read(cart, PRG, addr, mem_hit);
 }
 
 void cart_prg_write(struct cart *cart, struct apu *apu, uint16_t addr, uint8_t v)
 {
-	switch (cart->hdr.mapper) {
-		case 1:   mmc1_prg_write(cart, addr, v);       break;
-		case 4:
-		case 206: mmc3_prg_write(cart, addr, v);       break;
-		case 5:   mmc5_prg_write(cart, apu, addr, v);  break;
-		case 9:   mmc2_prg_write(cart, addr, v);       break;
-		case 10:  mmc2_prg_write(cart, addr, v);       break;
-		case 18:  jaleco_prg_write(cart, addr, v);     break;
-		case 210:
-		case 19:  namco_prg_write(cart, addr, v);      break;
-		case 20:  fds_prg_write(cart, addr, v);        break;
-		case 21:  vrc_prg_write(cart, addr, v);        break;
-		case 22:  vrc_prg_write(cart, addr, v);        break;
-		case 24:  vrc6_prg_write(cart, addr, v);       break;
-		case 26:  vrc6_prg_write(cart, addr, v);       break;
-		case 23:  vrc_prg_write(cart, addr, v);        break;
-		case 25:  vrc_prg_write(cart, addr, v);        break;
-		case 69:  fme7_prg_write(cart, addr, v);       break;
-		case 85:  vrc7_prg_write(cart, addr, v);       break;
-		case 16:
-		case 159: fcg_prg_write(cart, addr, v);        break;
-		case 0:
-		case 2:
-		case 3:
-		case 7:
-		case 11:
-		case 13:
-		case 30:
-		case 31:
-		case 34:
-		case 38:
-		case 66:
-		case 70:
-		case 71:
-		case 77:
-		case 78:
-		case 79:
-		case 87:
-		case 89:
-		case 93:
-		case 94:
-		case 97:
-		case 101:
-		case 107:
-		case 111:
-		case 113:
-		case 140:
-		case 145:
-		case 146:
-		case 148:
-		case 149:
-		case 152:
-		case 180:
-		case 184:
-		case 185: mapper_prg_write(cart, addr, v);     break;
-	}
+	if (cart->ops->prg_write)
+		cart->ops->prg_write(cart, apu, addr, v);
+
+	// Writes may move the deadline, the mapper is synced to the write beforehand
+	if (cart->ops->deadline)
+		cart_update_deadline(cart);
 }
 
 uint8_t cart_chr_read(struct cart *cart, uint16_t addr, enum mem type, bool nt)
 {
+	if (!cart->chr_hooked)
+		return cart->chr_slots[addr >> CHR_SHIFT][addr & (CHR_SLOT - 1)];
+
 	if (addr < 0x2000) {
-		switch (cart->hdr.mapper) {
-			case 5:  return mmc5_chr_read(cart, addr, type);
-			case 9:
-			case 10: return mmc2_chr_read(cart, addr);
-		}
+		if (cart->ops->chr_read)
+			return cart->ops->chr_read(cart, addr, type);
 
-	} else if (cart->hdr.mapper == 5) {
-		return mmc5_nt_read_hook(cart, addr, type, nt);
+	} else if (cart->ops->nt_read) {
+		return cart->ops->nt_read(cart, addr, type, nt);
 	}
 
 	return cart_read(cart, CHR, addr, NULL);
 }
 
 
+// Pattern cache
+
+static void cart_chr_cache_decode(struct cart *ctx, uint8_t index, size_t row)
+{
+	const uint8_t *data = ctx->range[RANGE_CHR].mem[index].data;
+	size_t offset = ((row >> 3) << 4) | (row & 0x07);
+
+	uint8_t low = data[offset];
+	uint8_t high = data[offset + 8];
+	uint8_t pixels[8];
+
+	for (uint8_t x = 0; x < 8; x++)
+		pixels[x] = ((low >> (7 - x)) & 0x01) | (((high >> (7 - x)) << 1) & 0x02);
+
+	memcpy(&ctx->chr_cache[index].rows[row], pixels, 8);
+}
+
+static void cart_chr_cache_invalidate(struct cart *ctx)
+{
+	struct chr_cache *c = &ctx->chr_cache[MEM_RAM];
+
+	if (c->dirty)
+		memset(c->dirty, 1, c->num_rows);
+}
+
+void cart_set_chr_cache(struct cart *ctx, bool enabled)
+{
+	for (uint8_t x = MEM_ROM; x <= MEM_RAM; x++) {
+		struct chr_cache *c = &ctx->chr_cache[x];
+
+		free(c->rows);
+		free(c->dirty);
+		memset(c, 0, sizeof(struct chr_cache));
+
+		size_t size = ctx->range[RANGE_CHR].mem[x].size;
+
+		// Hooked mappers never take the deferred path that reads the cache
+		if (!enabled || size < 16 || cart_has_ppu_hooks(ctx))
+			continue;
+
+		c->num_rows = size / 2;
+		c->rows = malloc(c->num_rows * sizeof(uint64_t));
+
+		// CHR-ROM is decoded up front, CHR-RAM as rows are fetched after being written
+		if (x == MEM_ROM) {
+			for (size_t row = 0; row < c->num_rows; row++)
+				cart_chr_cache_decode(ctx, x, row);
+
+		} else {
+			c->dirty = malloc(c->num_rows);
+			cart_chr_cache_invalidate(ctx);
+		}
+	}
+}
+
+const uint64_t *cart_chr_row(struct cart *ctx, uint16_t addr)
+{
+	struct range *range = &ctx->range[RANGE_CHR];
+	struct map *m = map_get_slot_by_addr(range, CHR, addr);
+	uint8_t index = m->type & 0x03;
+
+	if (!m->mem || index > MEM_RAM)
+		return NULL;
+
+	struct chr_cache *c = &ctx->chr_cache[index];
+
+	if (!c->rows)
+		return NULL;
+
+	size_t offset = m->offset + (addr & range->mask);
+	size_t row = ((offset >> 4) << 3) | (offset & 0x07);
+
+	if (c->dirty && c->dirty[row]) {
+		cart_chr_cache_decode(ctx, index, row);
+		c->dirty[row] = 0;
+	}
+
+	return &c->rows[row];
+}
+
+
 // Hooks
 
 void cart_ppu_a12_toggle(struct cart *cart)
 {
-	if (cart->hdr.mapper == 4)
-		mmc3_ppu_a12_toggle(cart);
+	if (cart->ops->ppu_a12_toggle)
+		cart->ops->ppu_a12_toggle(cart);
 }
 
 void cart_ppu_write_hook(struct cart *cart, uint16_t addr, uint8_t v)
 {
-	if (cart->hdr.mapper == 5)
-		mmc5_ppu_write_hook(cart, addr, v);
+	if (cart->ops->ppu_write_hook)
+		cart->ops->ppu_write_hook(cart, addr, v);
 }
 
 bool cart_block_2007(struct cart *cart)
 {
-	if (cart->hdr.mapper == 185)
-		return mapper_block_2007(cart);
+	if (cart->ops->block_2007)
+		return cart->ops->block_2007(cart);
 
 	return false;
 }
 
+bool cart_has_ppu_hooks(struct cart *cart)
+{
+	// Mappers that observe individual PPU fetches
+	return cart->ops->ppu_a12_toggle || cart->chr_hooked;
+}
+
+bool cart_has_prg_hooks(struct cart *cart)
+{
+	// Mappers that observe CPU reads
+	return cart->ops->prg_read;
+}
+
+bool cart_has_step(struct cart *cart)
+{
+	return cart->ops->step != NULL;
+}
+
 
 // SRAM
 
@@ -369,22 +626,33 @@ void *cart_get_sram(struct cart *cart)
 
 void cart_step(struct cart *cart, struct cpu *cpu, struct apu *apu)
 {
-	switch (cart->hdr.mapper) {
-		case 4: mmc3_step(cart, cpu);       break;
-		case 5: mmc5_step(cart, cpu);       break;
-		case 18: jaleco_step(cart, cpu);    break;
-		case 19: namco_step(cart, cpu);     break;
-		case 20: fds_step(cart, cpu, apu);  break;
-		case 21: vrc_step(cart, cpu);       break;
-		case 23: vrc_step(cart, cpu);       break;
-		case 24: vrc6_step(cart, cpu, apu); break;
-		case 26: vrc6_step(cart, cpu, apu); break;
-		case 25: vrc_step(cart, cpu);       break;
-		case 69: fme7_step(cart, cpu, apu); break;
-		case 85: vrc_step(cart, cpu);       break;
-		case 16:
-		case 159: fcg_step(cart, cpu);      break;
-	}
+	if (cart->ops->step)
+		cart->ops->step(cart, cpu, apu);
+}
+
+void cart_sync(struct cart *cart, struct cpu *cpu, uint64_t cycle)
+{
+	// Catch up on every cycle before this one
+	if (!cart->ops->sync || cycle <= cart->synced)
+		return;
+
+	cart->ops->sync(cart, cpu, cycle - cart->synced);
+	cart->synced = cycle;
+
+	cart_update_deadline(cart);
+}
+
+uint64_t cart_get_deadline(struct cart *cart)
+{
+	return cart->deadline;
+}
+
+void cart_set_clock(struct cart *cart, uint64_t cycle)
+{
+	if (cart->deadline != DEADLINE_NONE)
+		cart->deadline = cart->deadline - cart->synced + cycle;
+
+	cart->synced = cycle;
 }
 
 
@@ -435,71 +703,25 @@ static void cart_restore_mem_map(struct cart *cart)
 
 static bool cart_init_mapper(struct cart *ctx)
 {
+	cart_update_chr_slots(ctx);
+
 	cart_map(ctx, PRG_ROM, 0x8000, 0, 32);
 	cart_map(ctx, cart_get_chr_type(ctx), 0x0000, 0, 8);
 	cart_map_ciram(ctx, ctx->hdr.mirror);
 
-	switch (ctx->hdr.mapper) {
-		case 1:   mmc1_create(ctx);    break;
-		case 4:
-		case 206: mmc3_create(ctx);    break;
-		case 5:   mmc5_create(ctx);    break;
-		case 9:   mmc2_create(ctx);    break;
-		case 10:  mmc2_create(ctx);    break;
-		case 18:  jaleco_create(ctx);  break;
-		case 210:
-		case 19:  namco_create(ctx);   break;
-		case 20:  fds_create(ctx);     break;
-		case 21:  vrc2_4_create(ctx);  break;
-		case 22:  vrc2_4_create(ctx);  break;
-		case 24:  vrc_create(ctx);     break;
-		case 26:  vrc_create(ctx);     break;
-		case 23:  vrc2_4_create(ctx);  break;
-		case 25:  vrc2_4_create(ctx);  break;
-		case 69:  fme7_create(ctx);    break;
-		case 85:  vrc_create(ctx);     break;
-		case 16:
-		case 159: fcg_create(ctx);     break;
-		case 0:
-		case 2:
-		case 3:
-		case 7:
-		case 11:
-		case 13:
-		case 30:
-		case 31:
-		case 34:
-		case 38:
-		case 66:
-		case 70:
-		case 71:
-		case 77:
-		case 78:
-		case 79:
-		case 87:
-		case 89:
-		case 93:
-		case 94:
-		case 97:
-		case 101:
-		case 107:
-		case 111:
-		case 113:
-		case 140:
-		case 145:
-		case 146:
-		case 148:
-		case 149:
-		case 152:
-		case 180:
-		case 184:
-		case 185: mapper_create(ctx);  break;
-
-		default:
-			NES_Log("Mapper %u is unsupported", ctx->hdr.mapper);
-			return false;
+	ctx->ops = ctx->hdr.mapper < 256 ? &MAPPER_OPS[ctx->hdr.mapper] : NULL;
+
+	if (!ctx->ops || !ctx->ops->create) {
+		NES_Log("Mapper %u is unsupported", ctx->hdr.mapper);
+		return false;
 	}
 
+	ctx->ops->create(ctx);
+
+	ctx->chr_hooked = ctx->ops->chr_read || ctx->ops->nt_read;
+	ctx->synced = 0;
+	cart_update_deadline(ctx);
+
 	return true;
 }
 
@@ -672,6 +894,8 @@ void cart_destroy(struct cart **cart)
 
 	struct cart *ctx = *cart;
 
+	cart_set_chr_cache(ctx, false);
+
 	free(ctx->rom);
 	free(ctx->ram);
 
@@ -683,6 +907,7 @@ void cart_reset(struct cart *cart)
 {
 	memset(cart->mapper, 0, MAPPER_MAX);
 	memset(cart->ram, 0, cart->ram_size);
+	cart_chr_cache_invalidate(cart);
 
 	cart_init_mapper(cart);
 }
@@ -755,17 +980,24 @@ bool cart_set_state(struct cart *cart, const void *state, size_t size)
 		return false;
 
 	uint8_t *rom = cart->rom;
+	const struct mapper_ops *ops = cart->ops;
+	struct chr_cache chr_cache[2] = {cart->chr_cache[0], cart->chr_cache[1]};
 
 	free(cart->ram);
 
 	*cart = *((const struct cart *) state);
 	cart->rom = rom;
+	cart->ops = ops;
+	cart->chr_cache[0] = chr_cache[0];
+	cart->chr_cache[1] = chr_cache[1];
 
 	cart->ram = calloc(cart->ram_size, 1);
 	memcpy(cart->ram, (uint8_t *) state + sizeof(struct cart), cart->ram_size);
 
 	cart_set_data_pointers(cart);
 	cart_restore_mem_map(cart);
+	cart_update_chr_slots(cart);
+	cart_chr_cache_invalidate(cart);
 
 	return true;
 }
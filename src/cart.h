@@ -53,6 +53,10 @@ uint16_t cart_get_last_bank(struct cart *ctx, uint16_t bank_size);
 enum mem cart_get_chr_type(struct cart *ctx);
 void *cart_get_mapper(struct cart *ctx);
 const NES_CartDesc *cart_get_desc(struct cart *ctx);
+uint32_t cart_pop_bank_switches(struct cart *ctx);
+uint32_t cart_get_chr_generation(struct cart *ctx);
+bool cart_get_offset(struct cart *ctx, enum mem type, uint16_t addr, enum mem *mem_type, size_t *offset);
+bool cart_prg_is_ram(struct cart *ctx, uint16_t addr);
 
 // IO
 uint8_t cart_read(struct cart *ctx, enum mem type, uint16_t addr, bool *hit);
@@ -61,13 +65,23 @@ uint8_t cart_prg_read(struct cart *cart, struct apu *apu, uint16_t addr, bool *m
 void cart_prg_write(struct cart *cart, struct apu *apu, uint16_t addr, uint8_t v);
 uint8_t cart_chr_read(struct cart *cart, uint16_t addr, enum mem type, bool nt);
 
+// Pattern cache
+void cart_set_chr_cache(struct cart *ctx, bool enabled);
+const uint64_t *cart_chr_row(struct cart *ctx, uint16_t addr);
+
 // Hooks
 void cart_ppu_a12_toggle(struct cart *cart);
 void cart_ppu_write_hook(struct cart *cart, uint16_t addr, uint8_t v);
 bool cart_block_2007(struct cart *cart);
+bool cart_has_ppu_hooks(struct cart *cart);
+bool cart_has_prg_hooks(struct cart *cart);
+bool cart_has_step(struct cart *cart);
 
 // Step
 void cart_step(struct cart *cart, struct cpu *cpu, struct apu *apu);
+void cart_sync(struct cart *cart, struct cpu *cpu, uint64_t cycle);
+uint64_t cart_get_deadline(struct cart *cart);
+void cart_set_clock(struct cart *cart, uint64_t cycle);
 
 // SRAM
 size_t cart_get_sram_size(struct cart *cart);
@@ -242,11 +242,11 @@ float CoreGetAspectRatio(Core *ctx)
 	return 127.0f / 105.0f;
 }
 
-static void core_video(const uint32_t *frame, void *opaque)
+static void core_video(const NES_Frame *frame, void *opaque)
 {
 	// Crop top + bottom overscan 8px
-	CORE_VIDEO(frame + (NES_FRAME_WIDTH * 8), CORE_COLOR_FORMAT_BGRA,
-		NES_FRAME_WIDTH, NES_FRAME_HEIGHT - 16, NES_FRAME_WIDTH * 4, CORE_VIDEO_OPAQUE);
+	CORE_VIDEO((const uint8_t *) frame->pixels + frame->pitch * 8, CORE_COLOR_FORMAT_BGRA,
+		frame->width, frame->height - 16, frame->pitch, CORE_VIDEO_OPAQUE);
 }
 
 static void core_audio(const int16_t *frames, uint32_t count, void *opaque)
@@ -2,6 +2,13 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+
+#include "debug.h"
+
+#if !defined(_MSC_VER)
+	#define static_assert _Static_assert
+#endif
 
 enum cpu_flags {
 	FLAG_C = 0x01, // Carry
@@ -38,6 +45,8 @@ struct cpu {
 	bool nmi_signal;
 };
 
+static_assert(sizeof(struct cpu) <= CPU_STATE_MAX, "CPU is too big");
+
 
 // Addressing
 
@@ -76,6 +85,17 @@ static uint16_t cpu_read16(NES *nes, uint16_t addr)
 	return h | l;
 }
 
+static void cpu_dummy_fetch(struct cpu *cpu, NES *nes)
+{
+	// The value read at PC is dropped, it isn't an instruction byte or data
+	struct debug *dbg = sys_debug(nes);
+
+	if (dbg)
+		debug_cpu_dummy(dbg);
+
+	sys_read_cycle(nes, cpu->PC);
+}
+
 static void cpu_indexed_dummy_read(NES *nes, enum io_mode io_mode, bool pagex, uint16_t addr)
 {
 	if (io_mode == IO_RMW || io_mode == IO_W) {
@@ -94,7 +114,7 @@ static uint16_t cpu_opcode_address(struct cpu *cpu, NES *nes,
 	switch (mode) {
 		case MODE_IMPLIED:
 		case MODE_ACCUMULATOR:
-			sys_read_cycle(nes, cpu->PC); // Dummy read
+			cpu_dummy_fetch(cpu, nes);
 			break;
 
 		case MODE_IMMEDIATE:
@@ -729,7 +749,7 @@ static void cpu_sbc(struct cpu *cpu, uint8_t v)
 static void cpu_branch(struct cpu *cpu, NES *nes, uint16_t addr)
 {
 	bool irq_was_pending = cpu->irq_pending;
-	sys_read_cycle(nes, cpu->PC);
+	cpu_dummy_fetch(cpu, nes);
 
 	// First try the un-pagecrossed version of the address
 	uint16_t target_pc = cpu->PC + (int8_t) addr;
@@ -737,7 +757,7 @@ static void cpu_branch(struct cpu *cpu, NES *nes, uint16_t addr)
 
 	// Branching to a new page always requires another read
 	if (target_pc != cpu->PC) {
-		sys_read_cycle(nes, cpu->PC);
+		cpu_dummy_fetch(cpu, nes);
 		cpu->PC = target_pc;
 
 	// On a taken non-page crossing branch, the tick above does NOT poll for IRQ
@@ -749,6 +769,12 @@ static void cpu_branch(struct cpu *cpu, NES *nes, uint16_t addr)
 
 static bool cpu_exec(struct cpu *cpu, NES *nes)
 {
+	// Queried again after bus access, a step resumed past a stop reports what follows it
+	struct debug *dbg = sys_debug(nes);
+
+	if (dbg)
+		debug_cpu_exec(dbg, cpu->PC, cpu->A, cpu->X, cpu->Y, cpu->P, cpu->SP, sys_get_cycle(nes));
+
 	uint8_t code = sys_read_cycle(nes, cpu->PC++);
 	const struct opcode *op = &OP[code];
 
@@ -868,6 +894,11 @@ static bool cpu_exec(struct cpu *cpu, NES *nes)
 			cpu_read_sp(cpu, nes); // Internal operation (predecrement S?)
 			cpu_push16(cpu, nes, cpu->PC - 1);
 			cpu->PC = addr;
+
+			dbg = sys_debug(nes);
+
+			if (dbg)
+				debug_cpu_call(dbg, addr);
 			break;
 
 		case JMP:
@@ -945,7 +976,12 @@ static bool cpu_exec(struct cpu *cpu, NES *nes)
 		case RTS:
 			cpu_read_sp(cpu, nes); // Increment S
 			cpu->PC = cpu_pull16(cpu, nes) + 1;
-			sys_read_cycle(nes, cpu->PC); // increment PC
+			cpu_dummy_fetch(cpu, nes); // increment PC
+
+			dbg = sys_debug(nes);
+
+			if (dbg)
+				debug_cpu_return(dbg);
 			break;
 
 		case PLA:
@@ -986,6 +1022,11 @@ static bool cpu_exec(struct cpu *cpu, NES *nes)
 			cpu_read_sp(cpu, nes); // Increment S
 			cpu->P = (cpu_pull(cpu, nes) & 0xEF) | FLAG_U;
 			cpu->PC = cpu_pull16(cpu, nes);
+
+			dbg = sys_debug(nes);
+
+			if (dbg)
+				debug_cpu_return_interrupt(dbg, sys_get_cycle(nes));
 			break;
 
 		case PHP:
@@ -1015,6 +1056,11 @@ static bool cpu_exec(struct cpu *cpu, NES *nes)
 
 			// BRK blocks any execution of real interrupts until next instruction
 			cpu->irq_pending = false;
+
+			dbg = sys_debug(nes);
+
+			if (dbg)
+				debug_cpu_interrupt(dbg, DEBUG_BRK, sys_get_cycle(nes));
 			break;
 
 		} case TSX:
@@ -1201,9 +1247,11 @@ void cpu_poll_interrupts(struct cpu *cpu)
 
 static void cpu_trigger_interrupt(struct cpu *cpu, NES *nes)
 {
+	uint64_t cycle = sys_get_cycle(nes);
+
 	// Internal operation
-	sys_read_cycle(nes, cpu->PC);
-	sys_read_cycle(nes, cpu->PC);
+	cpu_dummy_fetch(cpu, nes);
+	cpu_dummy_fetch(cpu, nes);
 
 	cpu_push16(cpu, nes, cpu->PC);
 
@@ -1214,8 +1262,24 @@ static void cpu_trigger_interrupt(struct cpu *cpu, NES *nes)
 	SET_FLAG(cpu->P, FLAG_I);
 	cpu->PC = cpu_read16(nes, vector);
 
-	if (vector == NMI_VECTOR)
+	struct debug *dbg = sys_debug(nes);
+
+	if (dbg)
+		debug_cpu_interrupt(dbg, vector == NMI_VECTOR ? DEBUG_NMI : DEBUG_IRQ, cycle);
+
+	if (vector == NMI_VECTOR) {
 		cpu->nmi_signal = false;
+		sys_stats(nes)->nmis++;
+
+	} else {
+		NES_FrameStats *stats = sys_stats(nes);
+
+		stats->irqs++;
+		stats->irqAPU += (cpu->IRQ & IRQ_APU) ? 1 : 0;
+		stats->irqDMC += (cpu->IRQ & IRQ_DMC) ? 1 : 0;
+		stats->irqMapper += (cpu->IRQ & IRQ_MAPPER) ? 1 : 0;
+		stats->irqFDS += (cpu->IRQ & IRQ_FDS) ? 1 : 0;
+	}
 }
 
 
@@ -1234,6 +1298,48 @@ bool cpu_step(struct cpu *cpu, NES *nes)
 }
 
 
+// Disassembly
+
+uint8_t cpu_op_size(uint8_t code)
+{
+	switch (OP[code].mode) {
+		case MODE_IMPLIED:
+		case MODE_ACCUMULATOR:
+			return 1;
+		case MODE_ABSOLUTE:
+		case MODE_ABSOLUTE_X:
+		case MODE_ABSOLUTE_Y:
+		case MODE_INDIRECT:
+			return 3;
+		default:
+			return 2;
+	}
+}
+
+void cpu_disassemble(uint16_t pc, const uint8_t *code, char *buf, size_t size)
+{
+	const struct opcode *op = &OP[code[0]];
+	const char *name = op->name ? op->name : "???";
+	uint16_t abs = (uint16_t) code[1] | ((uint16_t) code[2] << 8);
+
+	switch (op->mode) {
+		case MODE_IMPLIED:     snprintf(buf, size, "%s", name);                                   break;
+		case MODE_ACCUMULATOR: snprintf(buf, size, "%s A", name);                                 break;
+		case MODE_IMMEDIATE:   snprintf(buf, size, "%s #$%02X", name, code[1]);                   break;
+		case MODE_RELATIVE:    snprintf(buf, size, "%s $%04X", name, pc + 2 + (int8_t) code[1]);  break;
+		case MODE_ZERO_PAGE:   snprintf(buf, size, "%s $%02X", name, code[1]);                    break;
+		case MODE_ZERO_PAGE_X: snprintf(buf, size, "%s $%02X,X", name, code[1]);                  break;
+		case MODE_ZERO_PAGE_Y: snprintf(buf, size, "%s $%02X,Y", name, code[1]);                  break;
+		case MODE_ABSOLUTE:    snprintf(buf, size, "%s $%04X", name, abs);                        break;
+		case MODE_ABSOLUTE_X:  snprintf(buf, size, "%s $%04X,X", name, abs);                      break;
+		case MODE_ABSOLUTE_Y:  snprintf(buf, size, "%s $%04X,Y", name, abs);                      break;
+		case MODE_INDIRECT:    snprintf(buf, size, "%s ($%04X)", name, abs);                      break;
+		case MODE_INDIRECT_X:  snprintf(buf, size, "%s ($%02X,X)", name, code[1]);                break;
+		case MODE_INDIRECT_Y:  snprintf(buf, size, "%s ($%02X),Y", name, code[1]);                break;
+	}
+}
+
+
 // Lifecycle
 
 struct cpu *cpu_create(void)
@@ -1257,8 +1363,8 @@ void cpu_reset(struct cpu *cpu, NES *nes, bool hard)
 		cpu->nmi_signal = cpu->halt = false;
 
 	// Internal operation
-	sys_read_cycle(nes, cpu->PC);
-	sys_read_cycle(nes, cpu->PC);
+	cpu_dummy_fetch(cpu, nes);
+	cpu_dummy_fetch(cpu, nes);
 
 	// Supressed writes
 	sys_cycle(nes);
@@ -12,6 +12,9 @@ enum irq {
 	IRQ_FDS    = 0x08,
 };
 
+// Upper bound of cpu_get_state_size, for snapshots taken within a step
+#define CPU_STATE_MAX 32
+
 struct cpu;
 
 // Interrupts
@@ -23,6 +26,10 @@ void cpu_poll_interrupts(struct cpu *cpu);
 // Step
 bool cpu_step(struct cpu *cpu, NES *nes);
 
+// Disassembly
+uint8_t cpu_op_size(uint8_t code);
+void cpu_disassemble(uint16_t pc, const uint8_t *code, char *buf, size_t size);
+
 // Lifecycle
 struct cpu *cpu_create(void);
 void cpu_destroy(struct cpu **cpu);
@@ -0,0 +1,873 @@
+#include "debug.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "sys.h"
+
+#define TRACE_SIZE     0x10000 // Must be a power of 2
+
+#define PROF_NODES_MAX 0x10000
+#define PROF_DEPTH_MAX 64
+#define PROF_ROOT      0
+
+#define PROF_KEY_ROM   0x10000
+#define PROF_KEY_NMI   0xFFFFFFF0
+#define PROF_KEY_IRQ   0xFFFFFFF1
+#define PROF_KEY_BRK   0xFFFFFFF2
+#define PROF_KEY_ROOT  0xFFFFFFFF
+
+struct debug {
+	uint32_t flags;
+	NES *nes;
+	struct cart *cart;
+
+	struct prof {
+		// Flat counters indexed by PRG-ROM offset, or by CPU address outside of PRG-ROM
+		struct prof_counter {
+			uint64_t cycles;
+			uint32_t instructions;
+			uint16_t pc;
+		} *rom, *ram;
+
+		size_t rom_size;
+
+		// Call tree built from JSR/RTS and interrupt/RTI pairs
+		struct prof_node {
+			uint32_t key;
+			uint32_t parent;
+			uint32_t child;
+			uint32_t sibling;
+			uint8_t depth;
+			uint64_t cycles;
+		} *nodes;
+
+		uint32_t num_nodes;
+		uint32_t node;
+		uint32_t overflow; // Calls refused by prof_push, their returns don't move up the tree
+
+		// Instruction in progress, charged when the next one begins
+		struct prof_counter *counter;
+		uint32_t counter_node;
+		uint64_t cycle;
+		bool active;
+
+		// Interrupt handlers in progress
+		struct {
+			enum debug_interrupt type;
+			uint32_t node;
+			uint32_t overflow;
+			uint64_t cycle;
+		} handlers[PROF_DEPTH_MAX];
+
+		uint8_t num_handlers;
+		uint32_t nmi_cycles;
+		uint32_t irq_cycles;
+	} prof;
+
+	// Bus access counters for the frame in progress and since enabled
+	struct heat {
+		NES_Heatmap *frame;
+		NES_Heatmap *total;
+	} heat;
+
+	// Single producer (emulation), single consumer (reader) ring of executed instructions
+	struct trace {
+		NES_TraceEntry *ring;
+		uint32_t head;
+		uint32_t tail;
+		uint32_t dropped;
+		uint32_t frame;
+
+		struct {
+			uint16_t pc_start;
+			uint16_t pc_end;
+			uint32_t frame_start;
+			uint32_t frame_end;
+		} trigger;
+	} trace;
+
+	// Code/data log, PRG-ROM followed by CHR-ROM as in a .cdl file
+	struct cdl {
+		uint8_t *prg;
+		uint8_t *chr;
+		size_t prg_size;
+		size_t chr_size;
+
+		// Instruction in progress and a bit per byte of it already fetched, its own
+		// fetches are code
+		uint16_t pc;
+		uint8_t len;
+		uint8_t fetched;
+
+		// The next read is a DMC sample fetch or one whose value the CPU drops, not data
+		bool dmc;
+		bool dummy;
+	} cdl;
+};
+
+
+// Heatmap
+
+static void heat_free(struct heat *h)
+{
+	free(h->frame);
+	free(h->total);
+
+	memset(h, 0, sizeof(struct heat));
+}
+
+static bool heat_init(struct heat *h)
+{
+	heat_free(h);
+
+	h->frame = calloc(1, sizeof(NES_Heatmap));
+	h->total = calloc(1, sizeof(NES_Heatmap));
+
+	if (!h->frame || !h->total) {
+		heat_free(h);
+		return false;
+	}
+
+	return true;
+}
+
+static void cdl_prg_read(struct debug *dbg, uint16_t addr);
+
+void debug_cpu_read(struct debug *dbg, uint16_t addr)
+{
+	if (dbg->flags & NES_INSTRUMENT_HEATMAP) {
+		dbg->heat.frame->cpuReads[addr]++;
+		dbg->heat.total->cpuReads[addr]++;
+	}
+
+	if (dbg->flags & NES_INSTRUMENT_CDL)
+		cdl_prg_read(dbg, addr);
+}
+
+void debug_cpu_write(struct debug *dbg, uint16_t addr)
+{
+	dbg->heat.frame->cpuWrites[addr]++;
+	dbg->heat.total->cpuWrites[addr]++;
+}
+
+bool debug_get_heatmap(struct debug *dbg, NES_Heatmap *heatmap, bool cumulative)
+{
+	if (!(dbg->flags & NES_INSTRUMENT_HEATMAP))
+		return false;
+
+	*heatmap = cumulative ? *dbg->heat.total : *dbg->heat.frame;
+
+	return true;
+}
+
+
+// Profiler
+
+static void prof_free(struct prof *p)
+{
+	free(p->rom);
+	free(p->ram);
+	free(p->nodes);
+
+	memset(p, 0, sizeof(struct prof));
+}
+
+static bool prof_init(struct prof *p, struct cart *cart)
+{
+	prof_free(p);
+
+	p->rom_size = cart ? cart_get_size(cart, PRG_ROM) : 0;
+	p->rom = calloc(p->rom_size + 1, sizeof(struct prof_counter));
+	p->ram = calloc(0x10000, sizeof(struct prof_counter));
+	p->nodes = calloc(PROF_NODES_MAX, sizeof(struct prof_node));
+
+	if (!p->rom || !p->ram || !p->nodes) {
+		prof_free(p);
+		return false;
+	}
+
+	p->nodes[PROF_ROOT].key = PROF_KEY_ROOT;
+	p->num_nodes = 1;
+
+	return true;
+}
+
+static uint32_t prof_key(struct debug *dbg, uint16_t addr)
+{
+	enum mem type = PRG_RAM;
+	size_t offset = 0;
+
+	if (addr >= 0x4020 && cart_get_offset(dbg->cart, PRG, addr, &type, &offset) && type == PRG_ROM)
+		return PROF_KEY_ROM + (uint32_t) offset;
+
+	return addr;
+}
+
+static struct prof_counter *prof_get_counter(struct prof *p, uint32_t key)
+{
+	return key >= PROF_KEY_ROM ? &p->rom[key - PROF_KEY_ROM] : &p->ram[key];
+}
+
+static void prof_account(struct prof *p, uint64_t cycle)
+{
+	if (p->active) {
+		uint64_t cycles = cycle - p->cycle;
+
+		if (p->counter) {
+			p->counter->cycles += cycles;
+			p->counter->instructions++;
+		}
+
+		p->nodes[p->counter_node].cycles += cycles;
+	}
+
+	p->active = true;
+	p->cycle = cycle;
+}
+
+static void prof_push(struct prof *p, uint32_t key)
+{
+	struct prof_node *parent = &p->nodes[p->node];
+
+	// Code that never returns (stack manipulation, JSR used as a jump) would
+	// otherwise grow the tree forever
+	if (parent->depth + 1 >= PROF_DEPTH_MAX) {
+		p->overflow++;
+		return;
+	}
+
+	for (uint32_t x = parent->child; x != 0; x = p->nodes[x].sibling) {
+		if (p->nodes[x].key == key) {
+			p->node = x;
+			return;
+		}
+	}
+
+	if (p->num_nodes == PROF_NODES_MAX) {
+		p->overflow++;
+		return;
+	}
+
+	uint32_t x = p->num_nodes++;
+	struct prof_node *node = &p->nodes[x];
+
+	node->key = key;
+	node->parent = p->node;
+	node->sibling = parent->child;
+	node->depth = parent->depth + 1;
+	parent->child = x;
+
+	p->node = x;
+}
+
+static bool prof_is_handler(uint32_t key)
+{
+	return key == PROF_KEY_NMI || key == PROF_KEY_IRQ || key == PROF_KEY_BRK;
+}
+
+static void prof_append(char *buf, size_t size, size_t *len, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+
+	int n = vsnprintf(*len < size ? buf + *len : NULL, *len < size ? size - *len : 0, fmt, args);
+
+	va_end(args);
+
+	if (n > 0)
+		*len += n;
+}
+
+static void prof_append_label(struct prof *p, uint32_t key, char *buf, size_t size, size_t *len)
+{
+	switch (key) {
+		case PROF_KEY_ROOT: prof_append(buf, size, len, "main"); break;
+		case PROF_KEY_NMI:  prof_append(buf, size, len, "NMI");  break;
+		case PROF_KEY_IRQ:  prof_append(buf, size, len, "IRQ");  break;
+		case PROF_KEY_BRK:  prof_append(buf, size, len, "BRK");  break;
+		default:
+			if (key >= PROF_KEY_ROM) {
+				prof_append(buf, size, len, "%04X@%05X", prof_get_counter(p, key)->pc, key - PROF_KEY_ROM);
+
+			} else {
+				prof_append(buf, size, len, "%04X", key);
+			}
+			break;
+	}
+}
+
+static int prof_compare(const void *a, const void *b)
+{
+	const NES_ProfileEntry *ea = a;
+	const NES_ProfileEntry *eb = b;
+
+	return ea->cycles < eb->cycles ? 1 : ea->cycles > eb->cycles ? -1 : 0;
+}
+
+void debug_pop_handler_cycles(struct debug *dbg, uint32_t *nmi, uint32_t *irq)
+{
+	*nmi = dbg->prof.nmi_cycles;
+	*irq = dbg->prof.irq_cycles;
+
+	dbg->prof.nmi_cycles = 0;
+	dbg->prof.irq_cycles = 0;
+}
+
+size_t debug_get_profile(struct debug *dbg, NES_ProfileEntry *entries, size_t max)
+{
+	struct prof *p = &dbg->prof;
+
+	if (!p->ram)
+		return 0;
+
+	size_t total = 0;
+
+	for (size_t x = 0; x < p->rom_size; x++)
+		total += p->rom[x].instructions > 0 ? 1 : 0;
+
+	for (size_t x = 0; x < 0x10000; x++)
+		total += p->ram[x].instructions > 0 ? 1 : 0;
+
+	NES_ProfileEntry *all = calloc(total + 1, sizeof(NES_ProfileEntry));
+	size_t n = 0;
+
+	for (size_t x = 0; x < p->rom_size; x++) {
+		if (p->rom[x].instructions > 0) {
+			all[n].pc = p->rom[x].pc;
+			all[n].romOffset = (int32_t) x;
+			all[n].cycles = p->rom[x].cycles;
+			all[n].instructions = p->rom[x].instructions;
+			n++;
+		}
+	}
+
+	for (size_t x = 0; x < 0x10000; x++) {
+		if (p->ram[x].instructions > 0) {
+			all[n].pc = (uint16_t) x;
+			all[n].romOffset = -1;
+			all[n].cycles = p->ram[x].cycles;
+			all[n].instructions = p->ram[x].instructions;
+			n++;
+		}
+	}
+
+	qsort(all, n, sizeof(NES_ProfileEntry), prof_compare);
+
+	if (n > max)
+		n = max;
+
+	memcpy(entries, all, n * sizeof(NES_ProfileEntry));
+	free(all);
+
+	return n;
+}
+
+size_t debug_get_profile_stacks(struct debug *dbg, char *buf, size_t size)
+{
+	struct prof *p = &dbg->prof;
+	size_t len = 0;
+
+	if (size > 0)
+		buf[0] = '\0';
+
+	if (!p->nodes)
+		return 0;
+
+	// One line per call path in the folded format used by flamegraph.pl
+	for (uint32_t x = 0; x < p->num_nodes; x++) {
+		if (p->nodes[x].cycles == 0)
+			continue;
+
+		uint32_t path[PROF_DEPTH_MAX];
+		uint8_t depth = 0;
+
+		for (uint32_t y = x; depth < PROF_DEPTH_MAX; y = p->nodes[y].parent) {
+			path[depth++] = y;
+
+			if (y == PROF_ROOT)
+				break;
+		}
+
+		while (depth > 0) {
+			prof_append_label(p, p->nodes[path[--depth]].key, buf, size, &len);
+			prof_append(buf, size, &len, depth > 0 ? ";" : " ");
+		}
+
+		prof_append(buf, size, &len, "%llu\n", (unsigned long long) p->nodes[x].cycles);
+	}
+
+	return len;
+}
+
+
+// Trace
+
+static void trace_free(struct trace *t)
+{
+	free(t->ring);
+
+	t->ring = NULL;
+}
+
+static bool trace_init(struct trace *t)
+{
+	// The reader may be inside debug_read_trace, so the ring is allocated once and
+	// kept until debug_destroy, and head/tail only ever move forward
+	if (!t->ring)
+		t->ring = malloc(TRACE_SIZE * sizeof(NES_TraceEntry));
+
+	t->dropped = 0;
+
+	// Wraps to 0 when the first frame begins
+	t->frame = UINT32_MAX;
+
+	return t->ring;
+}
+
+static void trace_push(struct debug *dbg, uint16_t pc, uint8_t a, uint8_t x, uint8_t y,
+	uint8_t status, uint8_t sp, uint64_t cycle)
+{
+	struct trace *t = &dbg->trace;
+
+	if (pc < t->trigger.pc_start || pc > t->trigger.pc_end)
+		return;
+
+	if (t->frame < t->trigger.frame_start || t->frame > t->trigger.frame_end)
+		return;
+
+	// Never wait on the reader, drop entries instead
+	uint32_t head = t->head;
+
+	if (head - ATOMIC_LOAD(&t->tail) >= TRACE_SIZE) {
+		t->dropped++;
+		return;
+	}
+
+	NES_TraceEntry *e = &t->ring[head & (TRACE_SIZE - 1)];
+
+	e->cycle = cycle;
+	e->pc = pc;
+	e->a = a;
+	e->x = x;
+	e->y = y;
+	e->p = status;
+	e->sp = sp;
+
+	e->code[0] = sys_peek(dbg->nes, pc);
+	e->code[1] = sys_peek(dbg->nes, (uint16_t) (pc + 1));
+	e->code[2] = sys_peek(dbg->nes, (uint16_t) (pc + 2));
+
+	enum mem type = PRG_RAM;
+	size_t offset = 0;
+
+	e->romOffset = pc >= 0x4020 && cart_get_offset(dbg->cart, PRG, pc, &type, &offset) &&
+		type == PRG_ROM ? (int32_t) offset : -1;
+
+	sys_get_ppu_position(dbg->nes, &e->scanline, &e->dot);
+
+	ATOMIC_STORE(&t->head, head + 1);
+}
+
+void debug_set_trace_trigger(struct debug *dbg, uint16_t pc_start, uint16_t pc_end,
+	uint32_t frame_start, uint32_t frame_end)
+{
+	dbg->trace.trigger.pc_start = pc_start;
+	dbg->trace.trigger.pc_end = pc_end;
+	dbg->trace.trigger.frame_start = frame_start;
+	dbg->trace.trigger.frame_end = frame_end;
+}
+
+size_t debug_read_trace(struct debug *dbg, NES_TraceEntry *entries, size_t max)
+{
+	struct trace *t = &dbg->trace;
+
+	if (!t->ring)
+		return 0;
+
+	uint32_t tail = t->tail;
+	uint32_t avail = ATOMIC_LOAD(&t->head) - tail;
+	size_t n = avail < max ? avail : max;
+
+	for (size_t i = 0; i < n; i++)
+		entries[i] = t->ring[(tail + i) & (TRACE_SIZE - 1)];
+
+	ATOMIC_STORE(&t->tail, tail + (uint32_t) n);
+
+	return n;
+}
+
+size_t debug_format_trace(const NES_TraceEntry *entry, char *buf, size_t size)
+{
+	static const char *BYTES[] = {"", "%02X", "%02X %02X", "%02X %02X %02X"};
+
+	char bytes[9];
+	char dasm[32];
+
+	snprintf(bytes, sizeof(bytes), BYTES[cpu_op_size(entry->code[0])],
+		entry->code[0], entry->code[1], entry->code[2]);
+
+	cpu_disassemble(entry->pc, entry->code, dasm, sizeof(dasm));
+
+	int r = snprintf(buf, size, "%04X  %-8s  %-31s A:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3u,%3u CYC:%llu",
+		entry->pc, bytes, dasm, entry->a, entry->x, entry->y, entry->p, entry->sp,
+		entry->scanline, entry->dot, (unsigned long long) entry->cycle);
+
+	return r > 0 ? (size_t) r : 0;
+}
+
+uint32_t debug_pop_trace_dropped(struct debug *dbg)
+{
+	uint32_t dropped = dbg->trace.dropped;
+	dbg->trace.dropped = 0;
+
+	return dropped;
+}
+
+
+// CDL
+
+static void cdl_free(struct cdl *c)
+{
+	free(c->prg);
+
+	memset(c, 0, sizeof(struct cdl));
+}
+
+static bool cdl_init(struct cdl *c, struct cart *cart)
+{
+	cdl_free(c);
+
+	c->prg_size = cart ? cart_get_size(cart, PRG_ROM) : 0;
+	c->chr_size = cart ? cart_get_size(cart, CHR_ROM) : 0;
+	c->prg = calloc(c->prg_size + c->chr_size + 1, 1);
+
+	if (!c->prg) {
+		cdl_free(c);
+		return false;
+	}
+
+	c->chr = c->prg + c->prg_size;
+
+	return true;
+}
+
+static void cdl_prg_mark(struct debug *dbg, uint16_t addr, uint8_t flags)
+{
+	enum mem type = PRG_RAM;
+	size_t offset = 0;
+
+	if (addr < 0x4020 || !cart_get_offset(dbg->cart, PRG, addr, &type, &offset) || type != PRG_ROM)
+		return;
+
+	// The bank bits only describe the $8000-$FFFF window
+	if (addr >= 0x8000)
+		flags |= (addr >> 11) & NES_CDL_PRG_BANK;
+
+	dbg->cdl.prg[offset] |= flags;
+}
+
+static void cdl_prg_exec(struct debug *dbg, uint16_t pc)
+{
+	struct cdl *c = &dbg->cdl;
+
+	// Bytes are marked as the CPU fetches them
+	c->pc = pc;
+	c->len = cpu_op_size(sys_peek(dbg->nes, pc));
+	c->fetched = 0;
+}
+
+static void cdl_prg_read(struct debug *dbg, uint16_t addr)
+{
+	struct cdl *c = &dbg->cdl;
+
+	if (c->dmc) {
+		c->dmc = false;
+		return;
+	}
+
+	if (c->dummy) {
+		c->dummy = false;
+		return;
+	}
+
+	// Each opcode and operand byte is fetched once, two byte operands high byte first
+	uint16_t x = (uint16_t) (addr - c->pc);
+
+	if (x < c->len && !(c->fetched & (1 << x))) {
+		cdl_prg_mark(dbg, addr, x == 0 ? NES_CDL_PRG_CODE | NES_CDL_PRG_OPCODE : NES_CDL_PRG_CODE);
+		c->fetched |= 1 << x;
+		return;
+	}
+
+	cdl_prg_mark(dbg, addr, NES_CDL_PRG_DATA);
+}
+
+static void cdl_chr_read(struct debug *dbg, uint16_t addr, enum mem type)
+{
+	enum mem mem_type = CHR_RAM;
+	size_t offset = 0;
+
+	if (addr >= 0x2000)
+		return;
+
+	// Separate sprite/background banks are only mapped by MMC5
+	if (!cart_get_offset(dbg->cart, type, addr, &mem_type, &offset) &&
+		!cart_get_offset(dbg->cart, CHR, addr, &mem_type, &offset))
+		return;
+
+	if (mem_type != CHR_ROM)
+		return;
+
+	switch (type) {
+		case CHR_BG:  dbg->cdl.chr[offset] |= NES_CDL_CHR_DRAWN | NES_CDL_CHR_BG;     break;
+		case CHR_SPR: dbg->cdl.chr[offset] |= NES_CDL_CHR_DRAWN | NES_CDL_CHR_SPRITE; break;
+		default:
+			dbg->cdl.chr[offset] |= NES_CDL_CHR_READ;
+			break;
+	}
+}
+
+void debug_cpu_dmc(struct debug *dbg, uint16_t addr)
+{
+	cdl_prg_mark(dbg, addr, NES_CDL_PRG_PCM);
+
+	// The sample fetch that follows is not a data read
+	dbg->cdl.dmc = true;
+}
+
+void debug_cpu_dummy(struct debug *dbg)
+{
+	if (dbg->flags & NES_INSTRUMENT_CDL)
+		dbg->cdl.dummy = true;
+}
+
+size_t debug_get_cdl_size(struct debug *dbg)
+{
+	return (dbg->flags & NES_INSTRUMENT_CDL) ? dbg->cdl.prg_size + dbg->cdl.chr_size : 0;
+}
+
+bool debug_get_cdl(struct debug *dbg, void *cdl, size_t size)
+{
+	if (!(dbg->flags & NES_INSTRUMENT_CDL) || size < dbg->cdl.prg_size + dbg->cdl.chr_size)
+		return false;
+
+	memcpy(cdl, dbg->cdl.prg, dbg->cdl.prg_size + dbg->cdl.chr_size);
+
+	return true;
+}
+
+
+// PPU
+
+void debug_ppu_read(struct debug *dbg, uint16_t addr, enum mem type)
+{
+	if (dbg->flags & NES_INSTRUMENT_CDL)
+		cdl_chr_read(dbg, addr, type);
+
+	if (dbg->flags & NES_INSTRUMENT_HEATMAP) {
+		dbg->heat.frame->ppuReads[addr & 0x3FFF]++;
+		dbg->heat.total->ppuReads[addr & 0x3FFF]++;
+	}
+}
+
+void debug_ppu_write(struct debug *dbg, uint16_t addr)
+{
+	if (dbg->flags & NES_INSTRUMENT_HEATMAP) {
+		dbg->heat.frame->ppuWrites[addr & 0x3FFF]++;
+		dbg->heat.total->ppuWrites[addr & 0x3FFF]++;
+	}
+}
+
+
+// CPU
+
+void debug_cpu_exec(struct debug *dbg, uint16_t pc, uint8_t a, uint8_t x, uint8_t y,
+	uint8_t status, uint8_t sp, uint64_t cycle)
+{
+	if (dbg->flags & NES_INSTRUMENT_TRACE)
+		trace_push(dbg, pc, a, x, y, status, sp, cycle);
+
+	if (dbg->flags & NES_INSTRUMENT_CDL)
+		cdl_prg_exec(dbg, pc);
+
+	if (dbg->flags & NES_INSTRUMENT_PROFILER) {
+		struct prof *p = &dbg->prof;
+
+		prof_account(p, cycle);
+
+		p->counter = prof_get_counter(p, prof_key(dbg, pc));
+		p->counter->pc = pc;
+		p->counter_node = p->node;
+	}
+}
+
+void debug_cpu_interrupt(struct debug *dbg, enum debug_interrupt type, uint64_t cycle)
+{
+	if (dbg->flags & NES_INSTRUMENT_PROFILER) {
+		struct prof *p = &dbg->prof;
+
+		// The interrupt sequence itself is charged to the handler, BRK has
+		// already been charged as an instruction
+		if (type != DEBUG_BRK) {
+			prof_account(p, cycle);
+			p->counter = NULL;
+		}
+
+		if (p->num_handlers < PROF_DEPTH_MAX) {
+			p->handlers[p->num_handlers].type = type;
+			p->handlers[p->num_handlers].node = p->node;
+			p->handlers[p->num_handlers].overflow = p->overflow;
+			p->handlers[p->num_handlers].cycle = cycle;
+			p->num_handlers++;
+		}
+
+		prof_push(p, type == DEBUG_NMI ? PROF_KEY_NMI : type == DEBUG_IRQ ? PROF_KEY_IRQ : PROF_KEY_BRK);
+
+		if (type != DEBUG_BRK)
+			p->counter_node = p->node;
+	}
+}
+
+void debug_cpu_call(struct debug *dbg, uint16_t addr)
+{
+	if (dbg->flags & NES_INSTRUMENT_PROFILER)
+		prof_push(&dbg->prof, prof_key(dbg, addr));
+}
+
+void debug_cpu_return(struct debug *dbg)
+{
+	if (dbg->flags & NES_INSTRUMENT_PROFILER) {
+		struct prof *p = &dbg->prof;
+
+		if (p->overflow > 0) {
+			p->overflow--;
+
+		} else if (p->node != PROF_ROOT && !prof_is_handler(p->nodes[p->node].key)) {
+			p->node = p->nodes[p->node].parent;
+		}
+	}
+}
+
+void debug_cpu_return_interrupt(struct debug *dbg, uint64_t cycle)
+{
+	if (dbg->flags & NES_INSTRUMENT_PROFILER) {
+		struct prof *p = &dbg->prof;
+
+		// RTI without a known entry, i.e. profiling began inside a handler
+		if (p->num_handlers == 0) {
+			p->node = PROF_ROOT;
+			p->overflow = 0;
+			return;
+		}
+
+		p->num_handlers--;
+		p->node = p->handlers[p->num_handlers].node;
+		p->overflow = p->handlers[p->num_handlers].overflow;
+
+		uint32_t cycles = (uint32_t) (cycle - p->handlers[p->num_handlers].cycle);
+
+		switch (p->handlers[p->num_handlers].type) {
+			case DEBUG_NMI: p->nmi_cycles += cycles; break;
+			case DEBUG_IRQ: p->irq_cycles += cycles; break;
+			default:
+				break;
+		}
+	}
+}
+
+
+// Configuration
+
+uint32_t debug_set_flags(struct debug *dbg, uint32_t flags)
+{
+	uint32_t enabled = flags & ~dbg->flags;
+	uint32_t disabled = dbg->flags & ~flags;
+
+	dbg->flags = flags;
+
+	// Instruments whose buffers can't be allocated stay off
+	if ((enabled & NES_INSTRUMENT_PROFILER) && !prof_init(&dbg->prof, dbg->cart))
+		dbg->flags &= ~NES_INSTRUMENT_PROFILER;
+
+	if (disabled & NES_INSTRUMENT_PROFILER)
+		prof_free(&dbg->prof);
+
+	if ((enabled & NES_INSTRUMENT_HEATMAP) && !heat_init(&dbg->heat))
+		dbg->flags &= ~NES_INSTRUMENT_HEATMAP;
+
+	if (disabled & NES_INSTRUMENT_HEATMAP)
+		heat_free(&dbg->heat);
+
+	// Disabling the trace only stops pushes, the ring stays readable
+	if ((enabled & NES_INSTRUMENT_TRACE) && !trace_init(&dbg->trace))
+		dbg->flags &= ~NES_INSTRUMENT_TRACE;
+
+	if ((enabled & NES_INSTRUMENT_CDL) && !cdl_init(&dbg->cdl, dbg->cart))
+		dbg->flags &= ~NES_INSTRUMENT_CDL;
+
+	if (disabled & NES_INSTRUMENT_CDL)
+		cdl_free(&dbg->cdl);
+
+	return dbg->flags;
+}
+
+
+// Lifecycle
+
+struct debug *debug_create(NES *nes)
+{
+	struct debug *ctx = calloc(1, sizeof(struct debug));
+
+	ctx->nes = nes;
+
+	debug_set_trace_trigger(ctx, 0x0000, 0xFFFF, 0, UINT32_MAX);
+
+	return ctx;
+}
+
+void debug_destroy(struct debug **dbg)
+{
+	if (!dbg || !*dbg)
+		return;
+
+	struct debug *ctx = *dbg;
+
+	prof_free(&ctx->prof);
+	heat_free(&ctx->heat);
+	trace_free(&ctx->trace);
+	cdl_free(&ctx->cdl);
+
+	free(ctx);
+	*dbg = NULL;
+}
+
+uint32_t debug_reset(struct debug *dbg, struct cart *cart)
+{
+	dbg->cart = cart;
+
+	if ((dbg->flags & NES_INSTRUMENT_PROFILER) && !prof_init(&dbg->prof, cart))
+		dbg->flags &= ~NES_INSTRUMENT_PROFILER;
+
+	if ((dbg->flags & NES_INSTRUMENT_HEATMAP) && !heat_init(&dbg->heat))
+		dbg->flags &= ~NES_INSTRUMENT_HEATMAP;
+
+	if ((dbg->flags & NES_INSTRUMENT_CDL) && !cdl_init(&dbg->cdl, cart))
+		dbg->flags &= ~NES_INSTRUMENT_CDL;
+
+	// The ring may be in use by the reader, only the frame window restarts
+	if (dbg->flags & NES_INSTRUMENT_TRACE)
+		dbg->trace.frame = UINT32_MAX;
+
+	return dbg->flags;
+}
+
+void debug_frame(struct debug *dbg)
+{
+	if (dbg->flags & NES_INSTRUMENT_HEATMAP)
+		memset(dbg->heat.frame, 0, sizeof(NES_Heatmap));
+
+	if (dbg->flags & NES_INSTRUMENT_TRACE)
+		dbg->trace.frame++;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cart.h"
+
+enum debug_interrupt {
+	DEBUG_NMI = 0,
+	DEBUG_IRQ = 1,
+	DEBUG_BRK = 2,
+};
+
+struct debug;
+
+// CPU
+void debug_cpu_exec(struct debug *dbg, uint16_t pc, uint8_t a, uint8_t x, uint8_t y,
+	uint8_t status, uint8_t sp, uint64_t cycle);
+void debug_cpu_interrupt(struct debug *dbg, enum debug_interrupt type, uint64_t cycle);
+void debug_cpu_call(struct debug *dbg, uint16_t addr);
+void debug_cpu_return(struct debug *dbg);
+void debug_cpu_return_interrupt(struct debug *dbg, uint64_t cycle);
+void debug_cpu_read(struct debug *dbg, uint16_t addr);
+void debug_cpu_write(struct debug *dbg, uint16_t addr);
+void debug_cpu_dmc(struct debug *dbg, uint16_t addr);
+void debug_cpu_dummy(struct debug *dbg);
+
+// PPU
+void debug_ppu_read(struct debug *dbg, uint16_t addr, enum mem type);
+void debug_ppu_write(struct debug *dbg, uint16_t addr);
+
+// Heatmap
+bool debug_get_heatmap(struct debug *dbg, NES_Heatmap *heatmap, bool cumulative);
+
+// Profiler
+void debug_pop_handler_cycles(struct debug *dbg, uint32_t *nmi, uint32_t *irq);
+size_t debug_get_profile(struct debug *dbg, NES_ProfileEntry *entries, size_t max);
+size_t debug_get_profile_stacks(struct debug *dbg, char *buf, size_t size);
+
+// Trace
+void debug_set_trace_trigger(struct debug *dbg, uint16_t pc_start, uint16_t pc_end,
+	uint32_t frame_start, uint32_t frame_end);
+size_t debug_read_trace(struct debug *dbg, NES_TraceEntry *entries, size_t max);
+size_t debug_format_trace(const NES_TraceEntry *entry, char *buf, size_t size);
+uint32_t debug_pop_trace_dropped(struct debug *dbg);
+
+// CDL
+size_t debug_get_cdl_size(struct debug *dbg);
+bool debug_get_cdl(struct debug *dbg, void *cdl, size_t size);
+
+// Configuration
+uint32_t debug_set_flags(struct debug *dbg, uint32_t flags);
+
+// Lifecycle
+struct debug *debug_create(NES *nes);
+void debug_destroy(struct debug **dbg);
+uint32_t debug_reset(struct debug *dbg, struct cart *cart);
+void debug_frame(struct debug *dbg);
@@ -18,7 +18,7 @@ static void fcg_create(struct cart *cart)
 	cart_map_ciram(cart, NES_MIRROR_VERTICAL);
 }
 
-static void fcg_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
+static void fcg_prg_write(struct cart *cart, struct apu *apu, uint16_t addr, uint8_t v)
 {
 	const NES_CartDesc *hdr = cart_get_desc(cart);
 	struct fcg *fcg = cart_get_mapper(cart);
@@ -89,21 +89,42 @@ static void fcg_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
 	}
 }
 
-static void fcg_step(struct cart *cart, struct cpu *cpu)
+static uint64_t fcg_irq_distance(struct fcg *fcg)
+{
+	// Cycles until the counter is found at 0xFFFE, it is decremented on the way there
+	return ((fcg->irq.counter + 2) & 0xFFFF) + 1;
+}
+
+static void fcg_sync(struct cart *cart, struct cpu *cpu, uint64_t cycles)
 {
 	struct fcg *fcg = cart_get_mapper(cart);
 
+	if (cycles == 0)
+		return;
+
 	if (fcg->irq.ack) {
 		cpu_irq(cpu, IRQ_MAPPER, false);
 		fcg->irq.ack = false;
 	}
 
 	if (fcg->irq.enable) {
-		if (fcg->irq.counter == 0xFFFE) {
+		if (cycles >= fcg_irq_distance(fcg)) {
 			cpu_irq(cpu, IRQ_MAPPER, true);
+			fcg->irq.counter = 0xFFFE;
 			fcg->irq.enable = false;
+
 		} else {
-			fcg->irq.counter--;
+			fcg->irq.counter -= (uint16_t) cycles;
 		}
 	}
 }
+
+static uint64_t fcg_deadline(struct cart *cart)
+{
+	struct fcg *fcg = cart_get_mapper(cart);
+
+	if (fcg->irq.ack)
+		return 0;
+
+	return fcg->irq.enable ? fcg_irq_distance(fcg) - 1 : DEADLINE_NONE;
+}
@@ -259,7 +259,7 @@ static void fds_step_audio(struct fds_audio *fds, struct apu *apu)
 
 // IO
 
-static void fds_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
+static void fds_prg_write(struct cart *cart, struct apu *apu, uint16_t addr, uint8_t v)
 {
 	struct fds *fds = cart_get_mapper(cart);
 
@@ -402,7 +402,7 @@ static void fds_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
 	}
 }
 
-static uint8_t fds_prg_read(struct cart *cart, uint16_t addr, bool *mem_hit)
+static uint8_t fds_prg_read(struct cart *cart, struct apu *apu, uint16_t addr, bool *mem_hit)
 {
 	struct fds *fds = cart_get_mapper(cart);
 
@@ -43,7 +43,7 @@ static void fme7_create(struct cart *cart)
 		fme7->vol[x] = fme7_double_to_u16(x == 0 ? 0.0 : 1.0 / pow(1.6, 1.0 / 2 * (31 - x)));
 }
 
-static void fme7_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
+static void fme7_prg_write(struct cart *cart, struct apu *apu, uint16_t addr, uint8_t v)
 {
 	struct fme7 *fme7 = cart_get_mapper(cart);
 
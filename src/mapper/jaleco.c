@@ -42,7 +42,7 @@ static void jaleco_map_chr(struct cart *cart, struct jaleco *jaleco, uint8_t n,
 		(jaleco->CHR[n & 0xE] & 0xF) | ((jaleco->CHR[(n & 0xE) + 1] & 0xF) << 4), 1);
 }
 
-static void jaleco_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
+static void jaleco_prg_write(struct cart *cart, struct apu *apu, uint16_t addr, uint8_t v)
 {
 	struct jaleco *jaleco = cart_get_mapper(cart);
 
@@ -111,21 +111,41 @@ static void jaleco_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
 	}
 }
 
-static void jaleco_step(struct cart *cart, struct cpu *cpu)
+static uint64_t jaleco_irq_distance(struct jaleco *jaleco)
+{
+	// Cycles until the masked bits of the counter are decremented to 0, then it wraps
+	uint16_t counter = jaleco->irq.counter & jaleco->irq.value;
+
+	return counter > 0 ? counter : (uint64_t) jaleco->irq.value + 1;
+}
+
+static void jaleco_sync(struct cart *cart, struct cpu *cpu, uint64_t cycles)
 {
 	struct jaleco *jaleco = cart_get_mapper(cart);
 
+	if (cycles == 0)
+		return;
+
 	if (jaleco->irq.ack) {
 		cpu_irq(cpu, IRQ_MAPPER, false);
 		jaleco->irq.ack = false;
 	}
 
 	if (jaleco->irq.enable) {
-		uint16_t counter = jaleco->irq.counter & jaleco->irq.value;
-
-		if (--counter == 0)
+		if (cycles >= jaleco_irq_distance(jaleco))
 			cpu_irq(cpu, IRQ_MAPPER, true);
 
-		jaleco->irq.counter = (jaleco->irq.counter & ~jaleco->irq.value) | (counter & jaleco->irq.value);
+		uint16_t counter = (uint16_t) ((jaleco->irq.counter - cycles) & jaleco->irq.value);
+		jaleco->irq.counter = (jaleco->irq.counter & ~jaleco->irq.value) | counter;
 	}
 }
+
+static uint64_t jaleco_deadline(struct cart *cart)
+{
+	struct jaleco *jaleco = cart_get_mapper(cart);
+
+	if (jaleco->irq.ack)
+		return 0;
+
+	return jaleco->irq.enable ? jaleco_irq_distance(jaleco) - 1 : DEADLINE_NONE;
+}
@@ -139,7 +139,7 @@ static bool mapper_block_2007(struct cart *cart)
 	return !(M[185].mirror_shift & 0xFE);
 }
 
-static void mapper_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
+static void mapper_prg_write(struct cart *cart, struct apu *apu, uint16_t addr, uint8_t v)
 {
 	const NES_CartDesc *hdr = cart_get_desc(cart);
 
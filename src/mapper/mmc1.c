@@ -115,7 +115,7 @@ static void mmc1_create(struct cart *cart)
 	cart_map(cart, PRG_RAM, 0x6000, 0, 8);
 }
 
-static void mmc1_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
+static void mmc1_prg_write(struct cart *cart, struct apu *apu, uint16_t addr, uint8_t v)
 {
 	struct mmc1 *mmc1 = cart_get_mapper(cart);
 
@@ -31,7 +31,7 @@ static void mmc2_create(struct cart *cart)
 	}
 }
 
-static uint8_t mmc2_chr_read(struct cart *cart, uint16_t addr)
+static uint8_t mmc2_chr_read(struct cart *cart, uint16_t addr, enum mem type)
 {
 	const NES_CartDesc *hdr = cart_get_desc(cart);
 	struct mmc2 *mmc2 = cart_get_mapper(cart);
@@ -63,7 +63,7 @@ static uint8_t mmc2_chr_read(struct cart *cart, uint16_t addr)
 	return v;
 }
 
-static void mmc2_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
+static void mmc2_prg_write(struct cart *cart, struct apu *apu, uint16_t addr, uint8_t v)
 {
 	const NES_CartDesc *hdr = cart_get_desc(cart);
 	struct mmc2 *mmc2 = cart_get_mapper(cart);
@@ -60,7 +60,7 @@ static void mmc3_create(struct cart *cart)
 	cart_map(cart, PRG_RAM, 0x6000, 0, 8);
 }
 
-static void mmc3_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
+static void mmc3_prg_write(struct cart *cart, struct apu *apu, uint16_t addr, uint8_t v)
 {
 	const NES_CartDesc *hdr = cart_get_desc(cart);
 	struct mmc3 *mmc3 = cart_get_mapper(cart);
@@ -126,7 +126,7 @@ static void mmc3_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
 	}
 }
 
-static uint8_t mmc3_prg_read(struct cart *cart, uint16_t addr, bool *mem_hit)
+static uint8_t mmc3_prg_read(struct cart *cart, struct apu *apu, uint16_t addr, bool *mem_hit)
 {
 	struct mmc3 *mmc3 = cart_get_mapper(cart);
 
@@ -143,7 +143,7 @@ static void mmc3_ppu_a12_toggle(struct cart *cart)
 	mmc3->irq.pending = true;
 }
 
-static void mmc3_step(struct cart *cart, struct cpu *cpu)
+static void mmc3_step(struct cart *cart, struct cpu *cpu, struct apu *apu)
 {
 	const NES_CartDesc *hdr = cart_get_desc(cart);
 	struct mmc3 *mmc3 = cart_get_mapper(cart);
@@ -468,7 +468,7 @@ static uint8_t mmc5_chr_read(struct cart *cart, uint16_t addr, enum mem type)
 	return 0;
 }
 
-static void mmc5_step(struct cart *cart, struct cpu *cpu)
+static void mmc5_step(struct cart *cart, struct cpu *cpu, struct apu *apu)
 {
 	struct mmc5 *mmc5 = cart_get_mapper(cart);
 
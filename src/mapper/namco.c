@@ -54,7 +54,7 @@ static void namco_map_ppu(struct cart *cart, struct namco *namco)
 	}
 }
 
-static void namco_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
+static void namco_prg_write(struct cart *cart, struct apu *apu, uint16_t addr, uint8_t v)
 {
 	const NES_CartDesc *hdr = cart_get_desc(cart);
 	struct namco *namco = cart_get_mapper(cart);
@@ -138,7 +138,7 @@ static void namco_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
 	}
 }
 
-static uint8_t namco_prg_read(struct cart *cart, uint16_t addr, bool *mem_hit)
+static uint8_t namco_prg_read(struct cart *cart, struct apu *apu, uint16_t addr, bool *mem_hit)
 {
 	struct namco *namco = cart_get_mapper(cart);
 
@@ -163,19 +163,42 @@ static uint8_t namco_prg_read(struct cart *cart, uint16_t addr, bool *mem_hit)
 	return 0;
 }
 
-static void namco_step(struct cart *cart, struct cpu *cpu)
+static uint64_t namco_irq_distance(struct namco *namco)
+{
+	// Cycles until the counter is incremented to 0x7FFE
+	return ((0x7FFE - namco->irq.counter - 1) & 0xFFFF) + 1;
+}
+
+static void namco_sync(struct cart *cart, struct cpu *cpu, uint64_t cycles)
 {
 	struct namco *namco = cart_get_mapper(cart);
 
+	if (cycles == 0)
+		return;
+
 	if (namco->irq.ack) {
 		cpu_irq(cpu, IRQ_MAPPER, false);
 		namco->irq.ack = false;
 	}
 
 	if (namco->irq.enable) {
-		if (++namco->irq.counter == 0x7FFE) {
+		if (cycles >= namco_irq_distance(namco)) {
 			cpu_irq(cpu, IRQ_MAPPER, true);
+			namco->irq.counter = 0x7FFE;
 			namco->irq.enable = false;
+
+		} else {
+			namco->irq.counter += (uint16_t) cycles;
 		}
 	}
 }
+
+static uint64_t namco_deadline(struct cart *cart)
+{
+	struct namco *namco = cart_get_mapper(cart);
+
+	if (namco->irq.ack)
+		return 0;
+
+	return namco->irq.enable ? namco_irq_distance(namco) - 1 : DEADLINE_NONE;
+}
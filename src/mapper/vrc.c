@@ -177,7 +177,7 @@ static void vrc_mirror(struct cart *cart, uint8_t v)
 	}
 }
 
-static void vrc_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
+static void vrc_prg_write(struct cart *cart, struct apu *apu, uint16_t addr, uint8_t v)
 {
 	struct vrc *vrc = cart_get_mapper(cart);
 
@@ -203,7 +203,7 @@ static void vrc_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
 			case 0x9002: // PRG mode
 			case 0x9003:
 				if (vrc->is2) {
-					vrc_prg_write(cart, 0x9000, v);
+					vrc_prg_write(cart, apu, 0x9000, v);
 					return;
 				}
 
@@ -262,7 +262,7 @@ static void vrc_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
 	}
 }
 
-static uint8_t vrc_prg_read(struct cart *cart, uint16_t addr, bool *hit)
+static uint8_t vrc_prg_read(struct cart *cart, struct apu *apu, uint16_t addr, bool *hit)
 {
 	struct vrc *vrc = cart_get_mapper(cart);
 	uint8_t v = cart_read(cart, PRG, addr, hit);
@@ -277,7 +277,7 @@ static uint8_t vrc_prg_read(struct cart *cart, uint16_t addr, bool *hit)
 	return v;
 }
 
-static void vrc_step(struct cart *cart, struct cpu *cpu)
+static void vrc_step(struct cart *cart, struct cpu *cpu, struct apu *apu)
 {
 	struct vrc *vrc = cart_get_mapper(cart);
 
@@ -311,3 +311,103 @@ static void vrc_step(struct cart *cart, struct cpu *cpu)
 		}
 	}
 }
+
+static uint32_t vrc_prescaler_wait(int16_t scanline)
+{
+	// Cycles before the prescaler clocks the counter in scanline mode
+	return scanline <= 0 ? 0 : (scanline + 2) / 3;
+}
+
+static uint64_t vrc_prescale(struct vrc *vrc, uint64_t cycles)
+{
+	// Advance the prescaler, returns the number of scanline clocks. After its first
+	// clock it repeats every 341 cycles with exactly 3 clocks.
+	uint64_t clocks = 0;
+	bool periodic = false;
+
+	while (cycles > 0) {
+		if (periodic && cycles >= 341) {
+			clocks += cycles / 341 * 3;
+			cycles %= 341;
+			continue;
+		}
+
+		uint32_t wait = vrc_prescaler_wait(vrc->irq.scanline);
+
+		if (wait >= cycles) {
+			vrc->irq.scanline -= (int16_t) (cycles * 3);
+			break;
+		}
+
+		vrc->irq.scanline += 341 - (int16_t) (wait + 1) * 3;
+		cycles -= wait + 1;
+		clocks++;
+		periodic = true;
+	}
+
+	return clocks;
+}
+
+static void vrc_sync(struct cart *cart, struct cpu *cpu, uint64_t cycles)
+{
+	// Equivalent to vrc_step once per cycle
+	struct vrc *vrc = cart_get_mapper(cart);
+
+	if (vrc->is2 || cycles == 0)
+		return;
+
+	if (vrc->irq.ack) {
+		cpu_irq(cpu, IRQ_MAPPER, false);
+		vrc->irq.ack = false;
+	}
+
+	uint64_t clocks = vrc_prescale(vrc, cycles);
+
+	if (vrc->irq.cycle)
+		clocks = cycles;
+
+	if (vrc->irq.enable && clocks > 0) {
+		uint64_t distance = 0x100 - vrc->irq.counter;
+
+		if (clocks >= distance) {
+			cpu_irq(cpu, IRQ_MAPPER, true);
+			vrc->irq.counter = vrc->irq.value + (uint16_t) ((clocks - distance) % (0x100 - vrc->irq.value));
+
+		} else {
+			vrc->irq.counter += (uint16_t) clocks;
+		}
+	}
+}
+
+static uint64_t vrc_deadline(struct cart *cart)
+{
+	struct vrc *vrc = cart_get_mapper(cart);
+
+	if (vrc->is2)
+		return DEADLINE_NONE;
+
+	if (vrc->irq.ack)
+		return 0;
+
+	if (!vrc->irq.enable)
+		return DEADLINE_NONE;
+
+	// The cycle of the clock that finds the counter at 0xFF
+	uint32_t clocks = 0x100 - vrc->irq.counter;
+
+	if (vrc->irq.cycle)
+		return clocks - 1;
+
+	int16_t scanline = vrc->irq.scanline;
+	uint64_t cycles = 0;
+
+	while (true) {
+		uint32_t wait = vrc_prescaler_wait(scanline);
+
+		if (--clocks == 0)
+			return cycles + wait;
+
+		scanline += 341 - (int16_t) (wait + 1) * 3;
+		cycles += wait + 1;
+	}
+}
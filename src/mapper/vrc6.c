@@ -73,7 +73,7 @@ static void vrc6_map_ppu(struct cart *cart, struct vrc *vrc)
 	}
 }
 
-static void vrc6_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
+static void vrc6_prg_write(struct cart *cart, struct apu *apu, uint16_t addr, uint8_t v)
 {
 	const NES_CartDesc *hdr = cart_get_desc(cart);
 	struct vrc *vrc = cart_get_mapper(cart);
@@ -243,5 +243,5 @@ static void vrc6_step(struct cart *cart, struct cpu *cpu, struct apu *apu)
 	vrc6_pulse_step_timer(vrc, apu, 1);
 	vrc6_saw_step_timer(vrc, apu);
 
-	vrc_step(cart, cpu);
+	vrc_step(cart, cpu, apu);
 }
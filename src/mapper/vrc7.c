@@ -1,4 +1,4 @@
-static void vrc7_prg_write(struct cart *cart, uint16_t addr, uint8_t v)
+static void vrc7_prg_write(struct cart *cart, struct apu *apu, uint16_t addr, uint8_t v)
 {
 	struct vrc *vrc = cart_get_mapper(cart);
 
@@ -8,8 +8,10 @@
 #define NES_FRAME_WIDTH  256
 #define NES_FRAME_HEIGHT 240
 
+#define NES_NTSC_WIDTH   602
+
 #define NES_CONFIG_DEFAULTS \
-	{NES_PALETTE_KITRINX, 48000, NES_CHANNEL_ALL, 0, 0, 8, 7, true}
+	{NES_PALETTE_KITRINX, 48000, NES_CHANNEL_ALL, 0, 0, 8, 7, true, true, NES_PIXEL_BGRA, false}
 
 #ifdef __cplusplus
 extern "C" {
@@ -48,6 +50,29 @@ typedef enum {
 	NES_MIRROR_FOUR16     = 0x89ABCDEF,
 } NES_Mirror;
 
+typedef enum {
+	NES_INSTRUMENT_PROFILER = 0x01,
+	NES_INSTRUMENT_HEATMAP  = 0x02,
+	NES_INSTRUMENT_TRACE    = 0x04,
+	NES_INSTRUMENT_CDL      = 0x08,
+} NES_Instrument;
+
+// FCEUX compatible .cdl flags, extensions are marked
+typedef enum {
+	NES_CDL_PRG_CODE   = 0x01,
+	NES_CDL_PRG_DATA   = 0x02,
+	NES_CDL_PRG_BANK   = 0x0C, // $8000 based 8 KB window the byte was accessed through
+	NES_CDL_PRG_PCM    = 0x40,
+	NES_CDL_PRG_OPCODE = 0x80, // Extension, first byte of an instruction
+} NES_CDLPrg;
+
+typedef enum {
+	NES_CDL_CHR_DRAWN  = 0x01,
+	NES_CDL_CHR_READ   = 0x02,
+	NES_CDL_CHR_BG     = 0x04, // Extension
+	NES_CDL_CHR_SPRITE = 0x08, // Extension
+} NES_CDLChr;
+
 typedef enum {
 	NES_PALETTE_KITRINX   = 0,
 	NES_PALETTE_SMOOTH    = 1,
@@ -59,6 +84,14 @@ typedef enum {
 	NES_PALETTE_WAVEBEAM  = 7,
 } NES_Palette;
 
+typedef enum {
+	NES_PIXEL_BGRA    = 0,
+	NES_PIXEL_RGBA    = 1,
+	NES_PIXEL_RGB565  = 2,
+	NES_PIXEL_INDEX16 = 3, // Color with grayscale applied | emphasis << 6 | grayscale << 9
+	NES_PIXEL_INDEX8  = 4, // Color with grayscale applied, emphasis is dropped
+} NES_PixelFormat;
+
 typedef struct {
 	size_t offset;
 	size_t prgROMSize;
@@ -82,12 +115,94 @@ typedef struct {
 	uint8_t maxSprites;
 	uint8_t highPass;
 	bool stereo;
+	bool chrCache; // Decoded pattern cache, uses 4x the CHR size, skipped for mappers with PPU hooks
+	NES_PixelFormat pixelFormat;
+	bool dirtyRows; // Hash rows to fill NES_Frame dirtyRows, otherwise every row is reported dirty
 } NES_Config;
 
+typedef struct {
+	const void *pixels;
+	NES_PixelFormat format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t y;            // First row, non-zero for slices
+	size_t pitch;
+	// Rows are compared by a 64-bit hash, so a change can go unreported in the rare
+	// case of a collision. Only filled in with NES_Config dirtyRows set.
+	uint32_t dirtyRows[8]; // One bit per frame row changed since the previous frame
+	bool identical;        // No row in the frame or slice changed
+	uint64_t cycle;        // CPU cycle when the last row was delivered
+	uint8_t phase;         // NTSC subcarrier phase (0-11) at the start of frame row 0
+} NES_Frame;
+
+typedef struct {
+	uint8_t x;
+	uint8_t y;       // Top screen row, OAM Y + 1
+	uint8_t tile;    // For 8x16 sprites bit 0 selects the pattern table
+	uint8_t palette; // Sprite palette 0-3
+	uint8_t index;   // OAM slot
+	bool flipH;
+	bool flipV;
+	bool behind;     // Drawn behind the background
+	bool tall;       // 8x16
+} NES_Sprite;
+
+typedef struct {
+	uint32_t cycles;
+	uint32_t instructions;
+	uint32_t oamDMACycles;
+	uint32_t dmcDMACycles;
+	uint32_t nmis;
+	uint32_t irqs;      // IRQs taken
+	uint32_t irqAPU;    // IRQs taken with the source asserted, more than one source may be
+	uint32_t irqDMC;    // asserted per IRQ so these can add up to more than irqs
+	uint32_t irqMapper;
+	uint32_t irqFDS;
+	uint32_t ppuReads;
+	uint32_t ppuWrites;
+	uint32_t mapperWrites;
+	uint32_t bankSwitches;
+	uint32_t audioFrames;
+	uint32_t bgRowsReused;
+	uint32_t bgRowsFetched;
+	uint32_t nmiHandlerCycles; // NES_INSTRUMENT_PROFILER
+	uint32_t irqHandlerCycles; // NES_INSTRUMENT_PROFILER
+	uint32_t traceDropped;     // NES_INSTRUMENT_TRACE
+} NES_FrameStats;
+
+typedef struct {
+	uint16_t pc;
+	int32_t romOffset; // -1 outside of PRG-ROM
+	uint64_t cycles;
+	uint32_t instructions;
+} NES_ProfileEntry;
+
+typedef struct {
+	uint32_t cpuReads[0x10000];
+	uint32_t cpuWrites[0x10000];
+	uint32_t ppuReads[0x4000];
+	uint32_t ppuWrites[0x4000];
+} NES_Heatmap;
+
+typedef struct {
+	uint64_t cycle;
+	int32_t romOffset; // -1 outside of PRG-ROM
+	uint16_t pc;
+	uint16_t scanline;
+	uint16_t dot;
+	uint8_t code[3];
+	uint8_t a;
+	uint8_t x;
+	uint8_t y;
+	uint8_t p;
+	uint8_t sp;
+} NES_TraceEntry;
+
 typedef struct NES NES;
+typedef struct NES_NTSC NES_NTSC;
 
 typedef void (*NES_AudioCallback)(const int16_t *frames, uint32_t count, void *opaque);
-typedef void (*NES_VideoCallback)(const uint32_t *frame, void *opaque);
+typedef void (*NES_VideoCallback)(const NES_Frame *frame, void *opaque);
 typedef void (*NES_LogCallback)(const char *msg);
 
 // Cart
@@ -103,6 +218,45 @@ uint8_t NES_GetNumDisks(NES *ctx);
 // Step
 uint32_t NES_NextFrame(NES *ctx, NES_VideoCallback videoCallback,
 	NES_AudioCallback audioCallback, void *opaque);
+uint32_t NES_RunCycles(NES *ctx, uint32_t cycles, NES_VideoCallback videoCallback,
+	NES_AudioCallback audioCallback, void *opaque);
+// Scanlines count the overclock lines: cfg.preNMI lines come before vblank at 241,
+// cfg.postNMI lines after it, so the pre-render line is 261 + cfg.postNMI. Returns 0
+// without running if scanline is not below 262 + cfg.preNMI + cfg.postNMI.
+uint32_t NES_RunUntilScanline(NES *ctx, uint16_t scanline, NES_VideoCallback videoCallback,
+	NES_AudioCallback audioCallback, void *opaque);
+void NES_SetSliceCallback(NES *ctx, NES_VideoCallback sliceCallback, uint16_t lines, void *opaque);
+
+// Video
+bool NES_ConvertFrame(const NES_Frame *frame, NES_Palette palette, NES_PixelFormat format,
+	void *dst, size_t pitch);
+bool NES_AcquireFrame(NES *ctx, const NES_Frame *frame);
+void NES_ReleaseFrame(NES *ctx, const NES_Frame *frame);
+
+// NTSC
+NES_NTSC *NES_CreateNTSC(uint32_t width);
+void NES_DestroyNTSC(NES_NTSC **ntsc);
+bool NES_FilterNTSC(NES_NTSC *ntsc, const NES_Frame *frame, uint32_t y, uint32_t height,
+	void *dst, size_t pitch);
+
+// Observation
+bool NES_SetObservation(NES *ctx, uint8_t *luma, uint16_t width, uint16_t height);
+size_t NES_GetSprites(NES *ctx, NES_Sprite *sprites, size_t max);
+const uint8_t *NES_GetRAM(NES *ctx);
+
+// Stats
+void NES_GetFrameStats(NES *ctx, NES_FrameStats *stats);
+
+// Instrumentation
+void NES_SetInstrumentation(NES *ctx, uint32_t flags);
+size_t NES_GetProfile(NES *ctx, NES_ProfileEntry *entries, size_t max);
+size_t NES_GetProfileStacks(NES *ctx, char *buf, size_t size);
+bool NES_GetHeatmap(NES *ctx, NES_Heatmap *heatmap, bool cumulative);
+void NES_SetTraceTrigger(NES *ctx, uint16_t pcStart, uint16_t pcEnd, uint32_t frameStart, uint32_t frameEnd);
+size_t NES_ReadTrace(NES *ctx, NES_TraceEntry *entries, size_t max);
+size_t NES_FormatTrace(const NES_TraceEntry *entry, char *buf, size_t size);
+size_t NES_GetCDLSize(NES *ctx);
+bool NES_GetCDL(NES *ctx, void *cdl, size_t size);
 
 // Input
 void NES_ControllerState(NES *nes, uint8_t player, uint8_t state);
@@ -0,0 +1,188 @@
+#include "ntsc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Composite video model after Bisqwit's NTSC NES renderer: each pixel is 8 samples
+// of a square wave at 12 phases per subcarrier cycle, decoded with a 12 tap box window
+
+#define NTSC_SAMPLES (NES_FRAME_WIDTH * 8)
+#define NTSC_TAPS    12
+#define NTSC_PAD     (NTSC_TAPS / 2)
+
+// Output voltages for the low and high half of the wave per luma level
+static const float NTSC_LO[4] = {0.350f, 0.518f, 0.962f, 1.550f};
+static const float NTSC_HI[4] = {1.094f, 1.506f, 1.962f, 1.962f};
+
+#define NTSC_BLACK       0.518f
+#define NTSC_WHITE       1.962f
+#define NTSC_ATTENUATION 0.746f
+
+// cos/sin(PI * (phase + 3.9) / 6) / 12, the 3.9 is a hue tweak, repeated so any
+// 12 tap window starting at phase 0-11 is contiguous
+static const float NTSC_I[NTSC_TAPS * 2] = {
+	-0.037833f, -0.069889f, -0.083219f, -0.074251f, -0.045387f, -0.004361f,
+	 0.037833f,  0.069889f,  0.083219f,  0.074251f,  0.045387f,  0.004361f,
+	-0.037833f, -0.069889f, -0.083219f, -0.074251f, -0.045387f, -0.004361f,
+	 0.037833f,  0.069889f,  0.083219f,  0.074251f,  0.045387f,  0.004361f,
+};
+
+static const float NTSC_Q[NTSC_TAPS * 2] = {
+	 0.074251f,  0.045387f,  0.004361f, -0.037833f, -0.069889f, -0.083219f,
+	-0.074251f, -0.045387f, -0.004361f,  0.037833f,  0.069889f,  0.083219f,
+	 0.074251f,  0.045387f,  0.004361f, -0.037833f, -0.069889f, -0.083219f,
+	-0.074251f, -0.045387f, -0.004361f,  0.037833f,  0.069889f,  0.083219f,
+};
+
+struct NES_NTSC {
+	uint32_t width;
+
+	// Normalized samples for color | emphasis << 6 at phases 0-11, repeated
+	// so the 8 samples of a pixel starting at any phase are contiguous
+	float signal[512][NTSC_TAPS * 2];
+};
+
+
+// Signal
+
+static bool ntsc_in_phase(uint8_t color, uint8_t phase)
+{
+	return (color + phase) % 12 < 6;
+}
+
+static float ntsc_sample(uint16_t pixel, uint8_t phase)
+{
+	uint8_t color = pixel & 0x0F;
+	uint8_t level = color > 13 ? 1 : (pixel >> 4) & 0x03;
+	uint8_t emphasis = (pixel >> 6) & 0x07;
+
+	float low = NTSC_LO[level];
+	float high = NTSC_HI[level];
+
+	if (color == 0)
+		low = high;
+
+	if (color > 12)
+		high = low;
+
+	float s = ntsc_in_phase(color, phase) ? high : low;
+
+	if (((emphasis & 1) && ntsc_in_phase(0, phase)) ||
+		((emphasis & 2) && ntsc_in_phase(4, phase)) ||
+		((emphasis & 4) && ntsc_in_phase(8, phase)))
+		s *= NTSC_ATTENUATION;
+
+	return (s - NTSC_BLACK) / (NTSC_WHITE - NTSC_BLACK);
+}
+
+static uint32_t ntsc_clamp(float v)
+{
+	if (v <= 0.0f)
+		return 0;
+
+	if (v >= 1.0f)
+		return 255;
+
+	return (uint32_t) (v * 255.0f + 0.5f);
+}
+
+
+// Filter
+
+static void ntsc_filter_row(NES_NTSC *ctx, const void *src, NES_PixelFormat format,
+	uint8_t phase, uint32_t *dst)
+{
+	// Samples outside of the row are at the black level
+	float samples[NTSC_PAD + NTSC_SAMPLES + NTSC_PAD];
+	memset(samples, 0, sizeof(samples));
+
+	for (uint32_t x = 0; x < NES_FRAME_WIDTH; x++) {
+		uint16_t pixel = format == NES_PIXEL_INDEX16 ?
+			((const uint16_t *) src)[x] & 0x1FF : ((const uint8_t *) src)[x] & 0x3F;
+
+		const float *signal = ctx->signal[pixel] + (phase + x * 8) % 12;
+		float *s = samples + NTSC_PAD + x * 8;
+
+		for (uint8_t z = 0; z < 8; z++)
+			s[z] = signal[z];
+	}
+
+	for (uint32_t x = 0; x < ctx->width; x++) {
+		// The window covers samples center - 6 to center + 5, offset by NTSC_PAD
+		uint32_t center = (x * NTSC_SAMPLES + NTSC_SAMPLES / 2) / ctx->width;
+		const float *s = samples + center;
+		const float *ik = NTSC_I + (phase + center + NTSC_TAPS - NTSC_PAD) % 12;
+		const float *qk = NTSC_Q + (phase + center + NTSC_TAPS - NTSC_PAD) % 12;
+
+		float y = 0.0f;
+		float i = 0.0f;
+		float q = 0.0f;
+
+		for (uint8_t t = 0; t < NTSC_TAPS; t++) {
+			y += s[t];
+			i += s[t] * ik[t];
+			q += s[t] * qk[t];
+		}
+
+		y /= NTSC_TAPS;
+
+		uint32_t r = ntsc_clamp(y + 0.946882f * i + 0.623557f * q);
+		uint32_t g = ntsc_clamp(y - 0.274788f * i - 0.635691f * q);
+		uint32_t b = ntsc_clamp(y - 1.108545f * i + 1.709007f * q);
+
+		dst[x] = 0xFF000000 | (r << 16) | (g << 8) | b;
+	}
+}
+
+bool ntsc_filter(NES_NTSC *ctx, const NES_Frame *frame, uint32_t y, uint32_t height,
+	void *dst, size_t pitch)
+{
+	if (!ctx || !frame || !dst)
+		return false;
+
+	if (frame->format != NES_PIXEL_INDEX16 && frame->format != NES_PIXEL_INDEX8)
+		return false;
+
+	if (frame->width != NES_FRAME_WIDTH || y + height > frame->height)
+		return false;
+
+	// The context is read only here, hosts may filter disjoint row ranges in parallel
+	for (uint32_t row = y; row < y + height; row++) {
+		const uint8_t *src = (const uint8_t *) frame->pixels + row * frame->pitch;
+		uint32_t *out = (uint32_t *) ((uint8_t *) dst + (row - y) * pitch);
+
+		// Each scanline shifts the subcarrier by 4 of its 12 phases
+		uint8_t phase = (frame->phase + (frame->y + row) * 4) % 12;
+
+		ntsc_filter_row(ctx, src, frame->format, phase, out);
+	}
+
+	return true;
+}
+
+
+// Lifecycle
+
+NES_NTSC *ntsc_create(uint32_t width)
+{
+	if (width == 0)
+		return NULL;
+
+	NES_NTSC *ctx = calloc(1, sizeof(NES_NTSC));
+	ctx->width = width;
+
+	for (uint16_t x = 0; x < 512; x++)
+		for (uint8_t y = 0; y < NTSC_TAPS * 2; y++)
+			ctx->signal[x][y] = ntsc_sample(x, y % 12);
+
+	return ctx;
+}
+
+void ntsc_destroy(NES_NTSC **ntsc)
+{
+	if (!ntsc || !*ntsc)
+		return;
+
+	free(*ntsc);
+	*ntsc = NULL;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nes.h"
+
+// Filter
+bool ntsc_filter(NES_NTSC *ntsc, const NES_Frame *frame, uint32_t y, uint32_t height,
+	void *dst, size_t pitch);
+
+// Lifecycle
+NES_NTSC *ntsc_create(uint32_t width);
+void ntsc_destroy(NES_NTSC **ntsc);
@@ -36,19 +36,137 @@ struct sprite {
 	uint8_t id;
 };
 
-struct spr {
-	uint8_t color;
-	bool priority;
-	bool sprite0;
+// Composed sprite line, one byte per pixel
+enum spr_flags {
+	SPR_COLOR    = 0x1F, // Palette index including the sprite palette bit
+	SPR_OPAQUE   = 0x10,
+	SPR_PRIORITY = 0x20,
+	SPR_SPRITE0  = 0x40,
+};
+
+// Per-dot schedule, one table of actions for each kind of line
+enum ppu_line {
+	LINE_VISIBLE = 0,
+	LINE_POST    = 1, // 240
+	LINE_VBLANK  = 2, // 241 + cfg.preNMI
+	LINE_PRE     = 3, // 261 + cfg.postNMI
+	LINE_IDLE    = 4,
+	LINE_KINDS   = 5,
+};
+
+enum ppu_action {
+	ACT_RENDER             = 0x000001,
+	ACT_OUTPUT             = 0x000002,
+
+	// Line events before the background fetch
+	ACT_EVAL_RESET         = 0x000004,
+	ACT_POST_RENDER        = 0x000008,
+	ACT_VBLANK_SET         = 0x000010,
+	ACT_FLAGS_CLEAR        = 0x000020,
+	ACT_VBLANK_CLEAR       = 0x000040,
+	ACT_COPY_Y             = 0x000080,
+	ACT_OAM_GLITCH         = 0x000100,
+	ACT_EVENTS             = 0x0001FC,
+
+	// Background fetch step, a field rather than flags
+	ACT_BG_NT              = 0x000200,
+	ACT_BG_ATTR            = 0x000400,
+	ACT_BG_LOW             = 0x000600,
+	ACT_BG_HIGH            = 0x000800,
+	ACT_BG_STORE           = 0x000A00,
+	ACT_BG                 = 0x000E00,
+
+	ACT_EVAL               = 0x001000,
+
+	// Sprite fetch and end of line events
+	ACT_SCROLL_V           = 0x002000,
+	ACT_EVAL_EXTRA         = 0x004000,
+	ACT_FETCH_SPRITE       = 0x008000,
+	ACT_OAMADDR_RESET      = 0x010000,
+	ACT_SPRITES_CLEAR      = 0x020000,
+	ACT_FETCH_SPRITE_EXTRA = 0x040000,
+	ACT_DUMMY_NT           = 0x080000,
+	ACT_ODD_SKIP           = 0x100000,
+	ACT_SPRITES            = 0x1FE000,
+
+	ACT_ROW_DONE           = 0x200000, // With ACT_OUTPUT
+
+	// Only while rendering
+	ACT_RENDERING          = 0x1FFF80,
+};
+
+// Frames are rendered into a ring of buffers so a consumer can hold completed frames
+#define PPU_BUFFERS 3
+
+union pixels {
+	uint32_t u32[240][256];
+	uint16_t u16[240][256];
+	uint8_t u8[240][256];
+};
+
+struct buffers {
+	union pixels pixels[PPU_BUFFERS];
+	uint32_t held[PPU_BUFFERS]; // Released from any thread
 };
 
 struct ppu {
 	NES_Config cfg;
+	struct debug *debug;
+
+	// Generated from cfg, line is the kind of the current scanline
+	uint32_t actions[LINE_KINDS][341];
+	uint8_t line;
 
 	uint8_t output[256];
-	uint32_t pixels[240][256];
+
+	// Written in cfg.pixelFormat, palettes are packed in the same format
+	struct buffers *buffers;
+	union pixels *pixels;
+
 	uint32_t palettes[8][64];
 
+	// Hash of each completed row, rows that differ from the previous frame are dirty
+	uint64_t row_hash[240];
+	uint32_t dirty_rows[8];
+	uint16_t rows_done;
+
+	// Dots whose processing is deferred, either a whole visible line or an idle
+	// span that only advances the clock, see ppu_sync
+	uint16_t pending;
+	uint16_t pending_end;
+	bool pending_idle;
+
+	// Background rows fetched by ppu_step_line, reused while their fetch inputs are unchanged
+	struct bg_memo {
+		bool valid;
+		uint16_t v;
+		uint16_t v_end;
+		uint16_t bg_table;
+		uint32_t generation;
+		uint8_t bg[256];
+	} bg_memo[240];
+
+	uint32_t bg_reused;
+	uint32_t bg_fetched;
+
+	// Luma downsampled into a caller buffer as rows complete, see ppu_set_observation
+	struct observation {
+		uint8_t *dst;
+		uint16_t width;
+		uint16_t height;
+		uint16_t row;           // Destination row being accumulated
+		uint16_t rows;          // Source rows accumulated into it
+		uint8_t luma[8][64];
+		uint8_t column[256];    // Destination column of each source pixel
+		uint16_t columns[256];  // Source pixels per destination column
+		uint32_t sum[256];
+	} obs;
+
+	// NTSC subcarrier phase (0-11) at the start of the current frame, the
+	// skipped dot of odd frames shifts the next frame
+	uint8_t phase;
+	bool skipped;
+
 	// Members above this dummy variable are not serialized
 	uint8_t state_boundary;
 
@@ -99,7 +217,9 @@ struct ppu {
 	bool overflow;
 	bool has_sprites;
 	struct sprite sprites[64];
-	struct spr spr[256];
+	uint8_t spr[256 + 8]; // Padded for sprites overhanging the right edge
+	uint16_t spr_start;
+	uint16_t spr_end;
 
 	uint8_t open_bus;
 	uint8_t read_buffer;
@@ -194,6 +314,9 @@ static uint8_t ppu_read_palette(struct ppu *ppu, uint16_t addr)
 
 static uint8_t ppu_read_vram(struct ppu *ppu, struct cart *cart, uint16_t addr, enum mem type, bool nt)
 {
+	if (ppu->debug)
+		debug_ppu_read(ppu->debug, addr, type);
+
 	if (addr < 0x3F00) {
 		if (addr < 0x2000)
 			ppu_set_bus_v(ppu, cart, addr);
@@ -207,6 +330,9 @@ static uint8_t ppu_read_vram(struct ppu *ppu, struct cart *cart, uint16_t addr,
 
 static void ppu_write_vram(struct ppu *ppu, struct cart *cart, uint16_t addr, uint8_t v)
 {
+	if (ppu->debug)
+		debug_ppu_write(ppu->debug, addr);
+
 	if (addr < 0x3F00) {
 		if (addr < 0x2000)
 			ppu_set_bus_v(ppu, cart, addr);
@@ -226,6 +352,8 @@ static void ppu_write_vram(struct ppu *ppu, struct cart *cart, uint16_t addr, ui
 
 uint8_t ppu_read(struct ppu *ppu, struct cart *cart, uint16_t addr)
 {
+	ppu_sync(ppu, cart);
+
 	uint8_t v = ppu->open_bus;
 
 	switch (addr) {
@@ -285,8 +413,19 @@ uint8_t ppu_read(struct ppu *ppu, struct cart *cart, uint16_t addr)
 	return v;
 }
 
+static void ppu_store_oam(struct ppu *ppu, uint8_t v)
+{
+	// Attribute bytes have no bits 2-4
+	if ((ppu->OAMADDR + 2) % 4 == 0)
+		v &= 0xE3;
+
+	ppu->oam[ppu->OAMADDR++] = v;
+}
+
 void ppu_write(struct ppu *ppu, struct cart *cart, uint16_t addr, uint8_t v)
 {
+	ppu_sync(ppu, cart);
+
 	ppu->decay_high2 = ppu->decay_low5 = 0;
 	ppu->open_bus = v;
 
@@ -319,10 +458,7 @@ void ppu_write(struct ppu *ppu, struct cart *cart, uint16_t addr, uint8_t v)
 			// https://wiki.nesdev.com/w/index.php/PPU_registers#OAM_data_.28.242004.29_.3C.3E_read.2Fwrite
 
 			if (!ppu_visible(ppu)) {
-				if ((ppu->OAMADDR + 2) % 4 == 0)
-					v &= 0xE3;
-
-				ppu->oam[ppu->OAMADDR++] = v;
+				ppu_store_oam(ppu, v);
 
 			} else {
 				ppu->OAMADDR += 4;
@@ -362,6 +498,27 @@ void ppu_write(struct ppu *ppu, struct cart *cart, uint16_t addr, uint8_t v)
 	}
 }
 
+bool ppu_oam_idle(struct ppu *ppu, uint16_t dots)
+{
+	// Rendering only touches OAM on visible and pre-render lines, and the open bus
+	// only decays when the frame wraps
+	uint32_t pos = ppu->scanline * 341 + ppu->dot + ppu->pending;
+
+	return ppu->scanline >= 240 && pos + dots < 261 * 341;
+}
+
+void ppu_write_oam(struct ppu *ppu, struct cart *cart, const uint8_t *data)
+{
+	// Same as 256 writes to $2004 while ppu_oam_idle holds
+	ppu_sync(ppu, cart);
+
+	for (uint16_t x = 0; x < 256; x++)
+		ppu_store_oam(ppu, data[x]);
+
+	ppu->decay_high2 = ppu->decay_low5 = 0;
+	ppu->open_bus = data[255];
+}
+
 
 // Scrolling
 // https://wiki.nesdev.com/w/index.php/PPU_scrolling
@@ -443,45 +600,45 @@ static uint8_t ppu_read_tile_byte(struct ppu *ppu, struct cart *cart, uint8_t nt
 	return ppu_read_vram(ppu, cart, addr + offset, CHR_BG, false);
 }
 
-static uint8_t ppu_color(uint8_t low_tile, uint8_t high_tile, uint8_t attr, uint8_t shift)
-{
-	uint8_t color = ((high_tile >> shift) << 1) & 0x02;
-	color |= (low_tile >> shift) & 0x01;
+// Eight pixels are decoded at once with one byte per pixel in a uint64_t, byte 0 in
+// memory is the leftmost pixel. The masks select one bit of a replicated tile byte per lane.
+#define LANES_01 0x0101010101010101ULL
+#define LANES_7F 0x7F7F7F7F7F7F7F7FULL
 
-	if (color > 0)
-		color |= (attr << 2) & 0x0C;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	#define LANES_MSB_FIRST 0x8040201008040201ULL
+	#define LANES_LSB_FIRST 0x0102040810204080ULL
+#else
+	#define LANES_MSB_FIRST 0x0102040810204080ULL
+	#define LANES_LSB_FIRST 0x8040201008040201ULL
+#endif
 
-	return color;
+static uint64_t ppu_spread(uint8_t tile, uint64_t order)
+{
+	uint64_t bits = ((uint64_t) tile * LANES_01) & order;
+
+	return ((bits + LANES_7F) >> 7) & LANES_01;
 }
 
-static void ppu_store_bg(struct ppu *ppu, uint16_t bg_dot)
+static uint64_t ppu_apply_attr(uint64_t pixels, uint8_t attr)
 {
-	for (uint8_t x = 0; x < 8; x++)
-		ppu->bg[bg_dot + (7 - x)] = ppu_color(ppu->bgl, ppu->bgh, ppu->attr, x);
+	// Attribute bits are only applied to opaque pixels
+	return pixels | (((pixels | (pixels >> 1)) & LANES_01) * ((attr << 2) & 0x0C));
 }
 
-static void ppu_fetch_bg(struct ppu *ppu, struct cart *cart, uint16_t bg_dot)
+static uint64_t ppu_colors(uint8_t low_tile, uint8_t high_tile, uint8_t attr, bool flip)
 {
-	switch (ppu->dot % 8) {
-		case 1:
-			ppu->nt = ppu_read_nt_byte(ppu, cart, CHR_BG);
-			break;
-		case 3:
-			ppu->attr = ppu_read_attr_byte(ppu, cart, CHR_BG);
-			break;
-		case 5:
-			ppu->bgl = ppu_read_tile_byte(ppu, cart, ppu->nt, 0);
-			break;
-		case 7:
-			ppu->bgh = ppu_read_tile_byte(ppu, cart, ppu->nt, 8);
-			break;
-		case 0:
-			ppu_store_bg(ppu, bg_dot);
-			ppu_scroll_h(ppu);
-			break;
-	}
+	uint64_t order = flip ? LANES_LSB_FIRST : LANES_MSB_FIRST;
+
+	return ppu_apply_attr(ppu_spread(low_tile, order) | (ppu_spread(high_tile, order) << 1), attr);
 }
 
+static void ppu_store_bg(struct ppu *ppu, uint16_t bg_dot)
+{
+	uint64_t colors = ppu_colors(ppu->bgl, ppu->bgh, ppu->attr, false);
+
+	memcpy(ppu->bg + bg_dot, &colors, 8);
+}
 
 // Sprites
 // https://wiki.nesdev.com/w/index.php/PPU_OAM
@@ -528,22 +685,49 @@ static uint16_t ppu_sprite_addr(struct ppu *ppu, uint16_t row, uint8_t index, ui
 static void ppu_store_sprite_colors(struct ppu *ppu, uint8_t attr, uint8_t sprite_x, uint8_t id,
 	uint8_t low_tile, uint8_t high_tile)
 {
-	for (uint8_t x = 0; x < 8; x++) {
-		uint8_t shift = SPRITE_ATTR_FLIP_H(attr) ? x : 7 - x;
-		uint8_t color = ppu_color(low_tile, high_tile, SPRITE_ATTR_PALETTE(attr), shift);
-		uint16_t offset = sprite_x + x;
+	uint64_t colors = ppu_colors(low_tile, high_tile, SPRITE_ATTR_PALETTE(attr), SPRITE_ATTR_FLIP_H(attr));
 
-		if (offset < 256 && color != 0) {
-			ppu->has_sprites = true;
+	if (colors == 0)
+		return;
 
-			if (!ppu->spr[offset].sprite0)
-				ppu->spr[offset].sprite0 = id == 0 && offset != 255;
+	uint64_t opaque = (colors | (colors >> 1)) & LANES_01;
+	uint64_t line = 0;
+	memcpy(&line, ppu->spr + sprite_x, 8);
 
-			if (ppu->spr[offset].color == 0) {
-				ppu->spr[offset].color = color + 16;
-				ppu->spr[offset].priority = SPRITE_ATTR_PRIORITY(attr);
-			}
-		}
+	// Sprites are stored in OAM order, so pixels already set take priority
+	uint64_t unset = opaque & ~(line >> 4);
+	uint8_t flags = SPR_OPAQUE | (SPRITE_ATTR_PRIORITY(attr) ? SPR_PRIORITY : 0);
+
+	line |= (colors & (unset * 0x0F)) | (unset * flags);
+
+	if (id == 0)
+		line |= opaque * SPR_SPRITE0;
+
+	memcpy(ppu->spr + sprite_x, &line, 8);
+
+	// Sprite 0 can not hit at x=255
+	ppu->spr[255] &= ~SPR_SPRITE0;
+
+	if (!ppu->has_sprites) {
+		ppu->spr_start = sprite_x;
+		ppu->spr_end = sprite_x + 8;
+		ppu->has_sprites = true;
+
+	} else {
+		if (sprite_x < ppu->spr_start)
+			ppu->spr_start = sprite_x;
+
+		if (sprite_x + 8 > ppu->spr_end)
+			ppu->spr_end = sprite_x + 8;
+	}
+}
+
+static void ppu_clear_sprites(struct ppu *ppu)
+{
+	// Only the span touched by the previous line's sprites
+	if (ppu->has_sprites) {
+		memset(ppu->spr + ppu->spr_start, 0, ppu->spr_end - ppu->spr_start);
+		ppu->has_sprites = false;
 	}
 }
 
@@ -607,6 +791,58 @@ static void ppu_eval_sprites(struct ppu *ppu)
 	}
 }
 
+static void ppu_eval_sprites_line(struct ppu *ppu)
+{
+	// Equivalent to ppu_eval_sprites for dots 65-256 followed by the extra evaluation,
+	// valid when OAM is not accessed in between. Whole sprites are evaluated at once
+	// until secondary OAM is full, the overflow bug is left to the per dot machine.
+	uint8_t max = ppu->cfg.maxSprites;
+	uint16_t dots = 0;
+
+	if ((ppu->OAMADDR & 0x03) == 0) {
+		while (ppu->oam_n < 64 && ppu->soam_n < max) {
+			uint8_t y = SPRITE_Y(ppu->oam, ppu->OAMADDR);
+			int32_t row = ppu->scanline - y;
+			bool in_range = row >= 0 && row < ppu->CTRL.sprite_h;
+			uint16_t n = in_range ? 8 : 2;
+
+			// A sprite cut off at dot 256 is finished by the per dot machine
+			if (ppu->oam_n >= max && dots + n > 192)
+				break;
+
+			ppu->soam[ppu->soam_n][0] = y;
+
+			if (in_range) {
+				ppu->soam[ppu->soam_n][1] = SPRITE_INDEX(ppu->oam, ppu->OAMADDR);
+				ppu->soam[ppu->soam_n][2] = SPRITE_ATTR(ppu->oam, ppu->OAMADDR);
+				ppu->soam[ppu->soam_n][3] = SPRITE_X(ppu->oam, ppu->OAMADDR);
+
+				ppu->sprites[ppu->soam_n].id = ppu->oam_n;
+				ppu->soam_n++;
+			}
+
+			ppu->oam_n++;
+			ppu->OAMADDR += 4;
+			dots += n;
+		}
+
+		// Past the last sprite the machine only advances OAMADDR every other dot
+		if (ppu->oam_n >= 64 && dots < 192) {
+			uint16_t pairs = (192 - dots) / 2;
+
+			ppu->oam_n += pairs;
+			ppu->OAMADDR += pairs * 4;
+			dots += pairs * 2;
+		}
+	}
+
+	for (; dots < 192; dots++)
+		ppu_eval_sprites(ppu);
+
+	while (ppu->oam_n < max)
+		ppu_eval_sprites(ppu);
+}
+
 static void ppu_fetch_sprite(struct ppu *ppu, struct cart *cart, uint16_t dot)
 {
 	int32_t n = (dot - 257) / 8;
@@ -659,13 +895,13 @@ static void ppu_render(struct ppu *ppu, uint16_t dot)
 		}
 
 		if (ppu->has_sprites && ppu->MASK.show_sprites && (dot > 7 || ppu->MASK.show_left_sprites)) {
-			struct spr *spr = &ppu->spr[dot];
+			uint8_t spr = ppu->spr[dot];
 
-			if (spr->sprite0 && bg_color != 0)
+			if ((spr & SPR_SPRITE0) && bg_color != 0)
 				SET_FLAG(ppu->STATUS, FLAG_STATUS_S);
 
-			if (spr->color != 0 && (bg_color == 0 || !spr->priority))
-				addr = 0x3F00 + spr->color;
+			if ((spr & SPR_OPAQUE) && (bg_color == 0 || !(spr & SPR_PRIORITY)))
+				addr = 0x3F00 + (spr & SPR_COLOR);
 		}
 
 	} else if (ppu->output_v) {
@@ -679,13 +915,147 @@ static void ppu_output(struct ppu *ppu, uint16_t dot)
 {
 	uint8_t color = ppu->output[dot] & ppu->MASK.grayscale;
 
-	ppu->pixels[ppu->scanline][dot] = ppu->palettes[ppu->MASK.emphasis][color];
+	switch (ppu->cfg.pixelFormat) {
+		case NES_PIXEL_RGB565:
+			ppu->pixels->u16[ppu->scanline][dot] = (uint16_t) ppu->palettes[ppu->MASK.emphasis][color];
+			break;
+		case NES_PIXEL_INDEX16:
+			ppu->pixels->u16[ppu->scanline][dot] = color | (ppu->MASK.emphasis << 6) |
+				(ppu->MASK.grayscale == 0x30 ? 0x200 : 0);
+			break;
+		case NES_PIXEL_INDEX8:
+			ppu->pixels->u8[ppu->scanline][dot] = color;
+			break;
+		default:
+			ppu->pixels->u32[ppu->scanline][dot] = ppu->palettes[ppu->MASK.emphasis][color];
+			break;
+	}
+}
+
+static size_t ppu_pixel_size(NES_PixelFormat format)
+{
+	switch (format) {
+		case NES_PIXEL_RGB565:
+		case NES_PIXEL_INDEX16:
+			return 2;
+		case NES_PIXEL_INDEX8:
+			return 1;
+		default:
+			return 4;
+	}
+}
+
+static void ppu_observe_row(struct ppu *ppu, uint16_t row)
+{
+	// Box filter from the palette indices of the row, a destination row is written
+	// once its last source row completes
+	struct observation *obs = &ppu->obs;
+	uint16_t y = row * obs->height / 240;
+
+	if (y != obs->row || obs->rows == 0) {
+		memset(obs->sum, 0, sizeof(uint32_t) * obs->width);
+		obs->row = y;
+		obs->rows = 0;
+	}
+
+	const uint8_t *luma = obs->luma[ppu->MASK.emphasis];
+
+	for (uint16_t x = 0; x < 256; x++)
+		obs->sum[obs->column[x]] += luma[ppu->output[x] & ppu->MASK.grayscale];
+
+	obs->rows++;
+
+	if (row == 239 || (row + 1) * obs->height / 240 != y) {
+		uint8_t *dst = obs->dst + y * obs->width;
+
+		for (uint16_t x = 0; x < obs->width; x++)
+			dst[x] = (uint8_t) (obs->sum[x] / (obs->columns[x] * obs->rows));
+
+		obs->rows = 0;
+	}
+}
+
+static void ppu_row_hash(struct ppu *ppu, uint16_t row)
+{
+	const uint8_t *pixels = (const uint8_t *) ppu->pixels + row * 256 * ppu_pixel_size(ppu->cfg.pixelFormat);
+	size_t size = 256 * ppu_pixel_size(ppu->cfg.pixelFormat);
+	uint64_t hash = 0x9E3779B97F4A7C15ULL;
+
+	for (size_t x = 0; x < size; x += 8) {
+		uint64_t word = 0;
+		memcpy(&word, pixels + x, 8);
+
+		hash = (hash + word) * 0xFF51AFD7ED558CCDULL;
+		hash ^= hash >> 29;
+	}
+
+	if (hash != ppu->row_hash[row]) {
+		ppu->row_hash[row] = hash;
+		ppu->dirty_rows[row / 32] |= 1u << (row % 32);
+	}
+}
+
+static void ppu_row_done(struct ppu *ppu, uint16_t row)
+{
+	// Without hashing every row counts as changed
+	if (ppu->cfg.dirtyRows) {
+		ppu_row_hash(ppu, row);
+
+	} else {
+		ppu->dirty_rows[row / 32] |= 1u << (row % 32);
+	}
+
+	if (ppu->obs.dst)
+		ppu_observe_row(ppu, row);
+
+	ppu->rows_done = row + 1;
+}
+
+static void ppu_clear_pixels(struct ppu *ppu)
+{
+	// Indexed formats are cleared to black, color formats to zero
+	switch (ppu->cfg.pixelFormat) {
+		case NES_PIXEL_INDEX16:
+			for (uint16_t y = 0; y < 240; y++)
+				for (uint16_t x = 0; x < 256; x++)
+					ppu->pixels->u16[y][x] = 0x0F;
+			break;
+		case NES_PIXEL_INDEX8:
+			memset(ppu->pixels->u8, 0x0F, sizeof(ppu->pixels->u8));
+			break;
+		default:
+			memset(ppu->pixels, 0, sizeof(union pixels));
+			break;
+	}
+
+	// Observed as black, the next visible line renders its own colors first
+	memset(ppu->output, 0x0F, 256);
+
+	for (uint16_t y = 0; y < 240; y++)
+		ppu_row_done(ppu, y);
 }
 
 
 // Step
 // https://wiki.nesdev.com/w/index.php/PPU_rendering#Line-by-line_timing
 
+static uint8_t ppu_line_kind(struct ppu *ppu)
+{
+	if (ppu->scanline <= 239)
+		return LINE_VISIBLE;
+
+	if (ppu->scanline == 240)
+		return LINE_POST;
+
+	if (ppu->scanline == 241 + ppu->cfg.preNMI)
+		return LINE_VBLANK;
+
+	if (ppu->scanline == 261 + ppu->cfg.postNMI)
+		return LINE_PRE;
+
+	return LINE_IDLE;
+}
+
 static void ppu_clock(struct ppu *ppu)
 {
 	if (++ppu->dot > 340) {
@@ -697,6 +1067,11 @@ static void ppu_clock(struct ppu *ppu)
 			ppu->supress_nmi = false;
 			ppu->f = !ppu->f;
 
+			// Each scanline advances 341 * 8 master clocks, 4 mod 12
+			ppu->phase = (ppu->phase + (262 + ppu->cfg.preNMI + ppu->cfg.postNMI) * 4 +
+				(ppu->skipped ? 4 : 0)) % 12;
+			ppu->skipped = false;
+
 			// Decay the open bus after 58 frames (~1s)
 			if (ppu->decay_high2++ == 58)
 				ppu->open_bus &= 0x3F;
@@ -704,117 +1079,356 @@ static void ppu_clock(struct ppu *ppu)
 			if (ppu->decay_low5++ == 58)
 				ppu->open_bus &= 0xC0;
 		}
+
+		ppu->line = ppu_line_kind(ppu);
 	}
 }
 
-static void ppu_memory_access(struct ppu *ppu, struct cart *cart)
+static void ppu_step_dot(struct ppu *ppu, struct cart *cart)
 {
-	if (ppu->dot >= 1 && ppu->dot <= 256) {
-		if (ppu->dot == 1)
+	uint32_t a = ppu->actions[ppu->line][ppu->dot];
+
+	if (!ppu->rendering)
+		a &= ~ACT_RENDERING;
+
+	if (a & ACT_RENDER)
+		ppu_render(ppu, ppu->dot - 1);
+
+	// Delayed pixel output @Kitrinx
+	if (a & ACT_OUTPUT) {
+		ppu_output(ppu, ppu->dot - 3);
+
+		if (a & ACT_ROW_DONE)
+			ppu_row_done(ppu, ppu->scanline);
+	}
+
+	if (a & ACT_EVENTS) {
+		if (a & ACT_EVAL_RESET) {
+			ppu->oam_n = ppu->soam_n = ppu->eval_step = 0;
+			ppu->overflow = false;
+			memset(ppu->soam, 0xFF, 64 * 4);
+		}
+
+		if (a & ACT_POST_RENDER) {
+			ppu_set_bus_v(ppu, cart, ppu->v);
+
+			if (!ppu->palette_write)
+				ppu_clear_pixels(ppu);
+
+			ppu->new_frame = true;
+		}
+
+		if ((a & ACT_VBLANK_SET) && !ppu->supress_nmi)
+			SET_FLAG(ppu->STATUS, FLAG_STATUS_V);
+
+		if (a & ACT_FLAGS_CLEAR) {
+			UNSET_FLAG(ppu->STATUS, FLAG_STATUS_O);
+			UNSET_FLAG(ppu->STATUS, FLAG_STATUS_S);
+		}
+
+		if (a & ACT_VBLANK_CLEAR)
+			UNSET_FLAG(ppu->STATUS, FLAG_STATUS_V);
+
+		if (a & ACT_COPY_Y)
+			ppu_scroll_copy_y(ppu);
+
+		if (a & ACT_OAM_GLITCH)
 			ppu_oam_glitch(ppu);
+	}
 
-		ppu_fetch_bg(ppu, cart, ppu->dot + 8);
+	// Background fetches, dots 1-256 fill the line and dots 321-336 the next one
+	switch (a & ACT_BG) {
+		case ACT_BG_NT:
+			ppu->nt = ppu_read_nt_byte(ppu, cart, CHR_BG);
+			break;
+		case ACT_BG_ATTR:
+			ppu->attr = ppu_read_attr_byte(ppu, cart, CHR_BG);
+			break;
+		case ACT_BG_LOW:
+			ppu->bgl = ppu_read_tile_byte(ppu, cart, ppu->nt, 0);
+			break;
+		case ACT_BG_HIGH:
+			ppu->bgh = ppu_read_tile_byte(ppu, cart, ppu->nt, 8);
+			break;
+		case ACT_BG_STORE:
+			ppu_store_bg(ppu, ppu->dot >= 321 ? ppu->dot - 328 : ppu->dot + 8);
+			ppu_scroll_h(ppu);
+			break;
+	}
 
-		if (ppu->dot >= 65 && ppu->scanline != 261)
-			ppu_eval_sprites(ppu);
+	if (a & ACT_EVAL)
+		ppu_eval_sprites(ppu);
 
-		if (ppu->dot == 256) {
+	if (a & ACT_SPRITES) {
+		if (a & ACT_SCROLL_V)
 			ppu_scroll_v(ppu);
 
-			// Squeeze in more sprite evaluation if cfg.maxSprites > 32 (emulator hack)
-			while (ppu->oam_n < ppu->cfg.maxSprites && ppu->scanline != 261)
+		// Squeeze in more sprite evaluation if cfg.maxSprites > 32 (emulator hack)
+		if (a & ACT_EVAL_EXTRA) {
+			while (ppu->oam_n < ppu->cfg.maxSprites)
 				ppu_eval_sprites(ppu);
 		}
 
-	} else if (ppu->dot >= 257 && ppu->dot <= 320) {
-		ppu_fetch_sprite(ppu, cart, ppu->dot);
+		if (a & ACT_FETCH_SPRITE)
+			ppu_fetch_sprite(ppu, cart, ppu->dot);
 
-		ppu->OAMADDR = 0;
+		if (a & ACT_OAMADDR_RESET)
+			ppu->OAMADDR = 0;
 
-		if (ppu->dot == 257) {
-			if (ppu->has_sprites) {
-				memset(ppu->spr, 0, sizeof(struct spr) * 256);
-				ppu->has_sprites = false;
-			}
+		if (a & ACT_SPRITES_CLEAR) {
+			ppu_clear_sprites(ppu);
 			ppu_scroll_copy_x(ppu);
+		}
 
 		// Squeeze in additional sprite fetches if cfg.maxSprites > 8 (emulator hack)
-		} else if (ppu->dot == 320) {
+		if (a & ACT_FETCH_SPRITE_EXTRA) {
 			for (uint16_t n = 321; n < 321 + (ppu->cfg.maxSprites - 8) * 8; n++)
 				ppu_fetch_sprite(ppu, cart, n);
 		}
 
-	} else if (ppu->dot >= 321 && ppu->dot <= 336) {
-		ppu_fetch_bg(ppu, cart, ppu->dot - 328);
+		// Dummy nametable fetches, important for MMC5
+		if (a & ACT_DUMMY_NT)
+			ppu_read_nt_byte(ppu, cart, CHR_SPR);
 
-	// Dummy nametable fetches, important for MMC5
-	} else if (ppu->dot == 337 || ppu->dot == 339) {
-		ppu_read_nt_byte(ppu, cart, CHR_SPR);
+		if ((a & ACT_ODD_SKIP) && ppu->f) {
+			ppu->dot++;
+			ppu->skipped = true;
+		}
 	}
+
+	// Delayed VRAM update address @Kitrinx Visual NES
+	ppu->set_v >>= 1;
+	if (ppu->set_v & 1)
+		ppu_set_v(ppu, cart, ppu->tmp_v, false);
+
+	// Delayed rendering flag @Kitrinx Visual NES
+	ppu->rendering = ppu->MASK.show_bg || ppu->MASK.show_sprites;
+
+	ppu_clock(ppu);
 }
 
-void ppu_step(struct ppu *ppu, struct cart *cart)
+static void ppu_fetch_bg_line(struct ppu *ppu, struct cart *cart)
 {
-	if (ppu->dot == 0) {
-		ppu->oam_n = ppu->soam_n = ppu->eval_step = 0;
-		ppu->overflow = false;
-		memset(ppu->soam, 0xFF, 64 * 4);
+	for (uint16_t bg_dot = 16; bg_dot <= 264; bg_dot += 8) {
+		ppu->nt = ppu_read_nt_byte(ppu, cart, CHR_BG);
+		ppu->attr = ppu_read_attr_byte(ppu, cart, CHR_BG);
+
+		// Pattern fetches are not observed here, the last bus address and tile
+		// bytes are left by the fetches for the next line
+		const uint64_t *row = ppu->debug ? NULL :
+			cart_chr_row(cart, ppu->CTRL.bg_table + (ppu->nt * 16) + GET_FY(ppu->v));
+
+		if (row) {
+			uint64_t colors = ppu_apply_attr(*row, ppu->attr);
+			memcpy(ppu->bg + bg_dot, &colors, 8);
+
+		} else {
+			ppu->bgl = ppu_read_tile_byte(ppu, cart, ppu->nt, 0);
+			ppu->bgh = ppu_read_tile_byte(ppu, cart, ppu->nt, 8);
+			ppu_store_bg(ppu, bg_dot);
+		}
+
+		ppu_scroll_h(ppu);
 	}
+}
 
-	if (ppu->scanline <= 239) {
-		if (ppu->dot >= 1 && ppu->dot <= 256)
-			ppu_render(ppu, ppu->dot - 1);
+static bool ppu_fetch_bg_memo(struct ppu *ppu, struct cart *cart)
+{
+	// The fetched row is fully determined by v, the pattern table and the contents
+	// and mapping of CHR/CIRAM, which the cart generation tracks
+	if (ppu->debug)
+		return false;
 
-		// Delayed pixel output @Kitrinx
-		if (ppu->dot >= 3 && ppu->dot <= 258)
-			ppu_output(ppu, ppu->dot - 3);
+	struct bg_memo *memo = &ppu->bg_memo[ppu->scanline];
+	uint32_t generation = cart_get_chr_generation(cart);
 
-		if (ppu->rendering)
-			ppu_memory_access(ppu, cart);
+	if (memo->valid && memo->v == ppu->v && memo->bg_table == ppu->CTRL.bg_table &&
+		memo->generation == generation)
+	{
+		memcpy(ppu->bg + 16, memo->bg, 256);
+		ppu->v = memo->v_end;
+		ppu->bg_reused++;
 
-	} else if (ppu->scanline == 240) {
-		if (ppu->dot == 0) {
-			ppu_set_bus_v(ppu, cart, ppu->v);
+		return true;
+	}
 
-			if (!ppu->palette_write)
-				memset(ppu->pixels, 0, 256 * 240 * 4);
+	memo->v = ppu->v;
+	ppu_fetch_bg_line(ppu, cart);
+	ppu->bg_fetched++;
 
-			ppu->new_frame = true;
-		}
+	memo->valid = true;
+	memo->v_end = ppu->v;
+	memo->bg_table = ppu->CTRL.bg_table;
+	memo->generation = generation;
+	memcpy(memo->bg, ppu->bg + 16, 256);
 
-	} else if (ppu->scanline == 241 + ppu->cfg.preNMI) {
-		if (ppu->dot == 1 && !ppu->supress_nmi)
-			SET_FLAG(ppu->STATUS, FLAG_STATUS_V);
+	return true;
+}
 
-	} else if (ppu->scanline == 261 + ppu->cfg.postNMI) {
-		if (ppu->dot == 0) {
-			UNSET_FLAG(ppu->STATUS, FLAG_STATUS_O);
-			UNSET_FLAG(ppu->STATUS, FLAG_STATUS_S);
-		}
+static void ppu_step_blank_line(struct ppu *ppu)
+{
+	// Equivalent to ppu_step_dot for dots 0-340 of a visible line while rendering
+	// is disabled, every pixel shows the same backdrop or palette color at v
 
-		if (ppu->dot == 1)
-			UNSET_FLAG(ppu->STATUS, FLAG_STATUS_V);
+	// Dot 0
+	ppu->oam_n = ppu->soam_n = ppu->eval_step = 0;
+	ppu->overflow = false;
+	memset(ppu->soam, 0xFF, 64 * 4);
+
+	// Dots 1-258
+	ppu_render(ppu, 0);
+	memset(ppu->output, ppu->output[0], 256);
+
+	for (uint16_t dot = 0; dot < 256; dot++)
+		ppu_output(ppu, dot);
+
+	ppu_row_done(ppu, ppu->scanline);
+
+	ppu->dot = 0;
+	ppu->scanline++;
+	ppu->line = ppu_line_kind(ppu);
+}
+
+static uint16_t ppu_idle_dots(struct ppu *ppu)
+{
+	// Number of dots from the current one where ppu_step_dot would only advance the
+	// clock, spans stop short of the end of the line and any dot that sets or clears
+	// flags. Register access syncs first, so nothing can change during the span.
+	if (ppu->dot == 0 || ppu->scanline <= 239)
+		return 0;
+
+	if (ppu->scanline == 241 + ppu->cfg.preNMI)
+		return ppu->dot == 1 ? 0 : 341 - ppu->dot;
+
+	if (ppu->scanline == 261 + ppu->cfg.postNMI)
+		return (ppu->dot == 1 || ppu->rendering) ? 0 : 341 - ppu->dot;
+
+	return 341 - ppu->dot;
+}
+
+static void ppu_skip(struct ppu *ppu, uint16_t dots)
+{
+	// Advance through idle dots, the last one may wrap the line
+	ppu->dot += dots - 1;
+	ppu_clock(ppu);
+}
+
+static void ppu_step_line(struct ppu *ppu, struct cart *cart)
+{
+	// Equivalent to ppu_step_dot for dots 0-340 of a visible rendering line, valid
+	// when no register access or mapper fetch hook can observe the line in progress
+
+	// Dot 0
+	ppu->oam_n = ppu->soam_n = ppu->eval_step = 0;
+	ppu->overflow = false;
+	memset(ppu->soam, 0xFF, 64 * 4);
+
+	// Dots 1-256, pixels only depend on fetches that precede them
+	ppu_oam_glitch(ppu);
+
+	if (!ppu_fetch_bg_memo(ppu, cart))
+		ppu_fetch_bg_line(ppu, cart);
+
+	ppu_eval_sprites_line(ppu);
+
+	for (uint16_t dot = 0; dot < 256; dot++)
+		ppu_render(ppu, dot);
+
+	for (uint16_t dot = 0; dot < 256; dot++)
+		ppu_output(ppu, dot);
+
+	ppu_row_done(ppu, ppu->scanline);
+	ppu_scroll_v(ppu);
+
+	// Dots 257-320, only odd dots fetch
+	ppu_fetch_sprite(ppu, cart, 257);
+
+	ppu_clear_sprites(ppu);
+	ppu_scroll_copy_x(ppu);
+
+	for (uint16_t dot = 259; dot < 321 + (ppu->cfg.maxSprites - 8) * 8; dot += 2)
+		ppu_fetch_sprite(ppu, cart, dot);
+
+	ppu->OAMADDR = 0;
+
+	// Dots 321-340
+	for (uint16_t bg_dot = 0; bg_dot <= 8; bg_dot += 8) {
+		ppu->nt = ppu_read_nt_byte(ppu, cart, CHR_BG);
+		ppu->attr = ppu_read_attr_byte(ppu, cart, CHR_BG);
+		ppu->bgl = ppu_read_tile_byte(ppu, cart, ppu->nt, 0);
+		ppu->bgh = ppu_read_tile_byte(ppu, cart, ppu->nt, 8);
+		ppu_store_bg(ppu, bg_dot);
+		ppu_scroll_h(ppu);
+	}
+
+	ppu_read_nt_byte(ppu, cart, CHR_SPR);
+	ppu_read_nt_byte(ppu, cart, CHR_SPR);
+
+	ppu->dot = 0;
+	ppu->scanline++;
+	ppu->line = ppu_line_kind(ppu);
+}
+
+static bool ppu_defer(struct ppu *ppu, struct cart *cart)
+{
+	if (ppu->set_v != 0 || ppu->rendering != (ppu->MASK.show_bg || ppu->MASK.show_sprites))
+		return false;
+
+	if (ppu->scanline <= 239) {
+		if (ppu->rendering && cart_has_ppu_hooks(cart))
+			return false;
+
+		ppu->pending_end = 341;
+		ppu->pending_idle = false;
+
+	} else {
+		ppu->pending_end = ppu_idle_dots(ppu);
+		ppu->pending_idle = true;
+	}
+
+	return ppu->pending_end > 1;
+}
+
+void ppu_step(struct ppu *ppu, struct cart *cart)
+{
+	// Visible lines are deferred and rendered all at once if nothing touches the PPU
+	// before the line is complete, otherwise ppu_sync replays them dot by dot. Idle
+	// spans after the visible lines are deferred the same way and skipped over.
+	if (ppu->pending > 0) {
+		if (++ppu->pending == ppu->pending_end) {
+			ppu->pending = 0;
 
-		if (ppu->rendering) {
-			if (ppu->dot >= 280 && ppu->dot <= 304)
-				ppu_scroll_copy_y(ppu);
+			if (ppu->pending_idle) {
+				ppu_skip(ppu, ppu->pending_end);
 
-			ppu_memory_access(ppu, cart);
+			} else if (ppu->rendering) {
+				ppu_step_line(ppu, cart);
 
-			if (ppu->dot == 339 && ppu->f)
-				ppu->dot++;
+			} else {
+				ppu_step_blank_line(ppu);
+			}
 		}
+
+	} else if ((ppu->scanline <= 239 ? ppu->dot == 0 : ppu->dot != 0) && ppu_defer(ppu, cart)) {
+		ppu->pending = 1;
+
+	} else {
+		ppu_step_dot(ppu, cart);
 	}
+}
 
-	// Delayed VRAM update address @Kitrinx Visual NES
-	ppu->set_v >>= 1;
-	if (ppu->set_v & 1)
-		ppu_set_v(ppu, cart, ppu->tmp_v, false);
+void ppu_sync(struct ppu *ppu, struct cart *cart)
+{
+	uint16_t pending = ppu->pending;
+	ppu->pending = 0;
 
-	// Delayed rendering flag @Kitrinx Visual NES
-	ppu->rendering = ppu->MASK.show_bg || ppu->MASK.show_sprites;
+	if (pending > 0 && ppu->pending_idle) {
+		ppu_skip(ppu, pending);
 
-	ppu_clock(ppu);
+	} else {
+		for (uint16_t x = 0; x < pending; x++)
+			ppu_step_dot(ppu, cart);
+	}
 }
 
 bool ppu_new_frame(struct ppu *ppu)
@@ -822,19 +1436,149 @@ bool ppu_new_frame(struct ppu *ppu)
 	return ppu->new_frame;
 }
 
-const uint32_t *ppu_pixels(struct ppu *ppu)
+void ppu_get_slice(struct ppu *ppu, uint16_t y, uint16_t height, NES_Frame *frame)
 {
+	size_t pitch = 256 * ppu_pixel_size(ppu->cfg.pixelFormat);
+
+	frame->pixels = (const uint8_t *) ppu->pixels + y * pitch;
+	frame->format = ppu->cfg.pixelFormat;
+	frame->width = 256;
+	frame->height = height;
+	frame->y = y;
+	frame->pitch = pitch;
+	frame->phase = ppu->phase;
+	frame->identical = true;
+
+	memset(frame->dirtyRows, 0, sizeof(frame->dirtyRows));
+
+	for (uint16_t row = y; row < y + height; row++) {
+		if (ppu->dirty_rows[row / 32] & (1u << (row % 32))) {
+			frame->dirtyRows[row / 32] |= 1u << (row % 32);
+			frame->identical = false;
+		}
+	}
+}
+
+void ppu_get_frame(struct ppu *ppu, NES_Frame *frame)
+{
+	ppu_get_slice(ppu, 0, 240, frame);
+
 	ppu->new_frame = false;
+	ppu->rows_done = 0;
+
+	memset(ppu->dirty_rows, 0, sizeof(ppu->dirty_rows));
+}
+
+uint16_t ppu_rows_done(struct ppu *ppu)
+{
+	return ppu->rows_done;
+}
+
+static int8_t ppu_find_buffer(struct ppu *ppu, const void *pixels)
+{
+	for (int8_t x = 0; x < PPU_BUFFERS; x++)
+		if (pixels == &ppu->buffers->pixels[x])
+			return x;
+
+	return -1;
+}
+
+void ppu_next_buffer(struct ppu *ppu)
+{
+	// Keep rendering into the current buffer unless the last frame is held
+	int8_t cur = ppu_find_buffer(ppu, ppu->pixels);
+
+	if (!ATOMIC_LOAD(&ppu->buffers->held[cur]))
+		return;
+
+	for (int8_t x = 0; x < PPU_BUFFERS; x++) {
+		if (!ATOMIC_LOAD(&ppu->buffers->held[x])) {
+			ppu->pixels = &ppu->buffers->pixels[x];
+			break;
+		}
+	}
+}
+
+bool ppu_acquire_frame(struct ppu *ppu, const void *pixels)
+{
+	// One buffer always remains free for rendering
+	int8_t index = ppu_find_buffer(ppu, pixels);
+	uint8_t held = 0;
+
+	if (index < 0)
+		return false;
+
+	for (int8_t x = 0; x < PPU_BUFFERS; x++)
+		if (ATOMIC_LOAD(&ppu->buffers->held[x]) && x != index)
+			held++;
+
+	if (held + 1 >= PPU_BUFFERS)
+		return false;
+
+	ATOMIC_STORE(&ppu->buffers->held[index], 1);
+
+	return true;
+}
+
+void ppu_release_frame(struct ppu *ppu, const void *pixels)
+{
+	int8_t index = ppu_find_buffer(ppu, pixels);
 
-	return (const uint32_t *) ppu->pixels;
+	if (index >= 0)
+		ATOMIC_STORE(&ppu->buffers->held[index], 0);
+}
+
+void ppu_get_position(struct ppu *ppu, uint16_t *scanline, uint16_t *dot)
+{
+	*scanline = ppu->scanline;
+	*dot = ppu->dot + ppu->pending;
+}
+
+bool ppu_dots_until(struct ppu *ppu, uint16_t scanline, uint32_t *dots)
+{
+	// Dots until the scanline next begins, one short when wrapping around the frame
+	// because odd frames may skip a dot on the pre-render line
+	uint32_t lines = 262 + ppu->cfg.preNMI + ppu->cfg.postNMI;
+
+	if (scanline >= lines)
+		return false;
+
+	uint32_t frame = lines * 341;
+	uint32_t pos = (ppu->scanline * 341 + ppu->dot + ppu->pending) % frame;
+	uint32_t target = scanline * 341;
+
+	*dots = target > pos ? target - pos : target + frame - pos - 1;
+
+	return true;
+}
+
+void ppu_pop_bg_memo_stats(struct ppu *ppu, uint32_t *reused, uint32_t *fetched)
+{
+	*reused = ppu->bg_reused;
+	*fetched = ppu->bg_fetched;
+
+	ppu->bg_reused = ppu->bg_fetched = 0;
 }
 
 
 // Configuration
 
-static void ppu_generate_emphasis_tables(struct ppu *ppu, NES_Palette palette)
+static uint32_t ppu_pack_color(uint32_t bgra, NES_PixelFormat format)
 {
-	memcpy(ppu->palettes[0], PALETTES[palette], sizeof(uint32_t) * 64);
+	switch (format) {
+		case NES_PIXEL_RGBA:
+			return (bgra & 0xFF00FF00) | ((bgra & 0x00FF0000) >> 16) | ((bgra & 0x000000FF) << 16);
+		case NES_PIXEL_RGB565:
+			return ((bgra & 0x00F80000) >> 8) | ((bgra & 0x0000FC00) >> 5) | ((bgra & 0x000000F8) >> 3);
+		default:
+			return bgra;
+	}
+}
+
+static void ppu_generate_emphasis_tables(uint32_t palettes[8][64], NES_Palette palette,
+	NES_PixelFormat format)
+{
+	memcpy(palettes[0], PALETTES[palette], sizeof(uint32_t) * 64);
 
 	for (uint8_t x = 1; x < 8; x++) {
 		for (uint8_t y = 0; y < 64; y++) {
@@ -844,16 +1588,234 @@ static void ppu_generate_emphasis_tables(struct ppu *ppu, NES_Palette palette)
 			uint32_t g = (uint32_t) ((float) ((rgba & 0x0000FF00) >> 8) * EMPHASIS[x][1]);
 			uint32_t b = (uint32_t) ((float) ((rgba & 0x00FF0000) >> 16) * EMPHASIS[x][2]);
 
-			ppu->palettes[x][y] = r | (g << 8) | (b << 16) | 0xFF000000;
+			palettes[x][y] = r | (g << 8) | (b << 16) | 0xFF000000;
+		}
+	}
+
+	for (uint8_t x = 0; x < 8; x++)
+		for (uint8_t y = 0; y < 64; y++)
+			palettes[x][y] = ppu_pack_color(palettes[x][y], format);
+}
+
+static void ppu_generate_luma_table(uint8_t luma[8][64], NES_Palette palette)
+{
+	uint32_t colors[8][64];
+	ppu_generate_emphasis_tables(colors, palette, NES_PIXEL_BGRA);
+
+	for (uint8_t x = 0; x < 8; x++) {
+		for (uint8_t y = 0; y < 64; y++) {
+			uint32_t r = (colors[x][y] & 0x00FF0000) >> 16;
+			uint32_t g = (colors[x][y] & 0x0000FF00) >> 8;
+			uint32_t b = colors[x][y] & 0x000000FF;
+
+			luma[x][y] = (uint8_t) ((r * 77 + g * 150 + b * 29) >> 8);
+		}
+	}
+}
+
+static void ppu_generate_actions(struct ppu *ppu)
+{
+	memset(ppu->actions, 0, sizeof(ppu->actions));
+
+	for (uint16_t dot = 0; dot < 341; dot++) {
+		uint32_t fetch = 0;
+		uint32_t eval = 0;
+
+		if ((dot >= 1 && dot <= 256) || (dot >= 321 && dot <= 336)) {
+			switch (dot % 8) {
+				case 1: fetch |= ACT_BG_NT;    break;
+				case 3: fetch |= ACT_BG_ATTR;  break;
+				case 5: fetch |= ACT_BG_LOW;   break;
+				case 7: fetch |= ACT_BG_HIGH;  break;
+				case 0: fetch |= ACT_BG_STORE; break;
+			}
+		}
+
+		if (dot == 1)
+			fetch |= ACT_OAM_GLITCH;
+
+		if (dot >= 65 && dot <= 256)
+			eval |= ACT_EVAL;
+
+		if (dot == 256) {
+			fetch |= ACT_SCROLL_V;
+			eval |= ACT_EVAL_EXTRA;
 		}
+
+		if (dot >= 257 && dot <= 320) {
+			fetch |= ACT_OAMADDR_RESET;
+
+			if (dot & 0x01)
+				fetch |= ACT_FETCH_SPRITE;
+		}
+
+		if (dot == 257)
+			fetch |= ACT_SPRITES_CLEAR;
+
+		if (dot == 320)
+			fetch |= ACT_FETCH_SPRITE_EXTRA;
+
+		if (dot == 337 || dot == 339)
+			fetch |= ACT_DUMMY_NT;
+
+		uint32_t *visible = &ppu->actions[LINE_VISIBLE][dot];
+		uint32_t *pre = &ppu->actions[LINE_PRE][dot];
+
+		*visible = fetch | eval;
+
+		if (dot >= 1 && dot <= 256)
+			*visible |= ACT_RENDER;
+
+		if (dot >= 3 && dot <= 258)
+			*visible |= ACT_OUTPUT;
+
+		if (dot == 258)
+			*visible |= ACT_ROW_DONE;
+
+		// Sprite evaluation is skipped on line 261 only, after cfg.postNMI extra
+		// lines the pre-render line evaluates like a visible one
+		*pre = fetch | (ppu->cfg.postNMI > 0 ? eval : 0);
+
+		if (dot >= 280 && dot <= 304)
+			*pre |= ACT_COPY_Y;
 	}
+
+	for (uint8_t x = 0; x < LINE_KINDS; x++)
+		ppu->actions[x][0] |= ACT_EVAL_RESET;
+
+	ppu->actions[LINE_POST][0] |= ACT_POST_RENDER;
+	ppu->actions[LINE_VBLANK][1] |= ACT_VBLANK_SET;
+	ppu->actions[LINE_PRE][0] |= ACT_FLAGS_CLEAR;
+	ppu->actions[LINE_PRE][1] |= ACT_VBLANK_CLEAR;
+	ppu->actions[LINE_PRE][339] |= ACT_ODD_SKIP;
 }
 
 void ppu_set_config(struct ppu *ppu, const NES_Config *cfg)
 {
 	ppu->cfg = *cfg;
 
-	ppu_generate_emphasis_tables(ppu, ppu->cfg.palette);
+	ppu_generate_emphasis_tables(ppu->palettes, ppu->cfg.palette, ppu->cfg.pixelFormat);
+	ppu_generate_luma_table(ppu->obs.luma, ppu->cfg.palette);
+
+	// Rows written in a previous format or palette are not comparable
+	memset(ppu->row_hash, 0, sizeof(ppu->row_hash));
+	ppu_generate_actions(ppu);
+
+	ppu->line = ppu_line_kind(ppu);
+}
+
+void ppu_set_debug(struct ppu *ppu, struct debug *dbg)
+{
+	ppu->debug = dbg;
+}
+
+
+// Observation
+
+bool ppu_set_observation(struct ppu *ppu, uint8_t *luma, uint16_t width, uint16_t height)
+{
+	struct observation *obs = &ppu->obs;
+	obs->dst = NULL;
+
+	if (!luma)
+		return true;
+
+	if (width == 0 || width > 256 || height == 0 || height > 240)
+		return false;
+
+	obs->width = width;
+	obs->height = height;
+	obs->rows = 0;
+
+	memset(obs->columns, 0, sizeof(obs->columns));
+
+	for (uint16_t x = 0; x < 256; x++) {
+		obs->column[x] = (uint8_t) (x * width / 256);
+		obs->columns[obs->column[x]]++;
+	}
+
+	obs->dst = luma;
+
+	return true;
+}
+
+size_t ppu_get_sprites(struct ppu *ppu, NES_Sprite *sprites, size_t max)
+{
+	size_t n = 0;
+
+	for (uint8_t x = 0; x < 64 && n < max; x++) {
+		const uint8_t *spr = &ppu->oam[x * 4];
+
+		// Sprites at Y 0xEF and above are never drawn
+		if (spr[0] >= 0xEF)
+			continue;
+
+		NES_Sprite *s = &sprites[n++];
+		s->x = spr[3];
+		s->y = spr[0] + 1;
+		s->tile = spr[1];
+		s->palette = spr[2] & 0x03;
+		s->index = x;
+		s->flipH = spr[2] & 0x40;
+		s->flipV = spr[2] & 0x80;
+		s->behind = spr[2] & 0x20;
+		s->tall = ppu->CTRL.sprite_h == 16;
+	}
+
+	return n;
+}
+
+
+// Conversion
+
+static uint32_t ppu_unpack_color(uint32_t color, NES_PixelFormat format)
+{
+	return format == NES_PIXEL_RGBA ? ppu_pack_color(color, NES_PIXEL_RGBA) : color;
+}
+
+bool ppu_convert_frame(const NES_Frame *frame, NES_Palette palette, NES_PixelFormat format,
+	void *dst, size_t pitch)
+{
+	// Indexed pixels go through a table of every color and emphasis combination,
+	// 32-bit pixels are repacked. RGB565 and indexed destinations are lossy sources.
+	if (format > NES_PIXEL_RGB565 || frame->format == NES_PIXEL_RGB565)
+		return false;
+
+	uint32_t colors[8][64];
+	ppu_generate_emphasis_tables(colors, palette, format);
+
+	for (uint32_t y = 0; y < frame->height; y++) {
+		const uint8_t *src_row = (const uint8_t *) frame->pixels + y * frame->pitch;
+		uint8_t *dst_row = (uint8_t *) dst + y * pitch;
+
+		for (uint32_t x = 0; x < frame->width; x++) {
+			uint32_t color = 0;
+
+			switch (frame->format) {
+				case NES_PIXEL_INDEX16: {
+					uint16_t index = ((const uint16_t *) src_row)[x];
+					color = colors[(index >> 6) & 0x07][index & 0x3F];
+					break;
+				}
+				case NES_PIXEL_INDEX8:
+					color = colors[0][src_row[x] & 0x3F];
+					break;
+				default:
+					color = ppu_pack_color(ppu_unpack_color(((const uint32_t *) src_row)[x],
+						frame->format), format);
+					break;
+			}
+
+			if (format == NES_PIXEL_RGB565) {
+				((uint16_t *) dst_row)[x] = (uint16_t) color;
+
+			} else {
+				((uint32_t *) dst_row)[x] = color;
+			}
+		}
+	}
+
+	return true;
 }
 
 
@@ -864,6 +1826,8 @@ struct ppu *ppu_create(const NES_Config *cfg)
 	struct ppu *ctx = calloc(1, sizeof(struct ppu));
 
 	ctx->cfg = *cfg;
+	ctx->buffers = calloc(1, sizeof(struct buffers));
+	ctx->pixels = &ctx->buffers->pixels[0];
 
 	return ctx;
 }
@@ -873,16 +1837,31 @@ void ppu_destroy(struct ppu **ppu)
 	if (!ppu || !*ppu)
 		return;
 
-	free(*ppu);
+	struct ppu *ctx = *ppu;
+
+	free(ctx->buffers);
+
+	free(ctx);
 	*ppu = NULL;
 }
 
 void ppu_reset(struct ppu *ppu)
 {
 	NES_Config cfg = ppu->cfg;
+	struct debug *dbg = ppu->debug;
+	struct buffers *buffers = ppu->buffers;
+	union pixels *pixels = ppu->pixels;
+	struct observation obs = ppu->obs;
 
+	// Held frames and the observation buffer stay valid across a reset
 	memset(ppu, 0, sizeof(struct ppu));
+	ppu->obs = obs;
+
 	ppu_set_config(ppu, &cfg);
+	ppu_set_debug(ppu, dbg);
+
+	ppu->buffers = buffers;
+	ppu->pixels = pixels;
 
 	memcpy(ppu->palette_ram, POWER_UP_PALETTE, 32);
 
@@ -912,6 +1891,8 @@ bool ppu_set_state(struct ppu *ppu, const void *state, size_t size)
 	memcpy((uint8_t *) ppu + offset, state, ppu_get_state_size());
 
 	ppu_set_config(ppu, &cfg);
+	ppu->pending = 0;
+	memset(ppu->bg_memo, 0, sizeof(ppu->bg_memo));
 
 	return true;
 }
@@ -5,21 +5,42 @@
 
 #include "cart.h"
 #include "cpu.h"
+#include "debug.h"
 
 struct ppu;
 
 // IO
 uint8_t ppu_read(struct ppu *ppu, struct cart *cart, uint16_t addr);
 void ppu_write(struct ppu *ppu, struct cart *cart, uint16_t addr, uint8_t v);
+bool ppu_oam_idle(struct ppu *ppu, uint16_t dots);
+void ppu_write_oam(struct ppu *ppu, struct cart *cart, const uint8_t *data);
 
 // Step
 void ppu_step(struct ppu *ppu, struct cart *cart);
+void ppu_sync(struct ppu *ppu, struct cart *cart);
 void ppu_assert_nmi(struct ppu *ppu, struct cpu *cpu);
 bool ppu_new_frame(struct ppu *ppu);
-const uint32_t *ppu_pixels(struct ppu *ppu);
+void ppu_get_frame(struct ppu *ppu, NES_Frame *frame);
+void ppu_get_slice(struct ppu *ppu, uint16_t y, uint16_t height, NES_Frame *frame);
+uint16_t ppu_rows_done(struct ppu *ppu);
+void ppu_next_buffer(struct ppu *ppu);
+bool ppu_acquire_frame(struct ppu *ppu, const void *pixels);
+void ppu_release_frame(struct ppu *ppu, const void *pixels);
+void ppu_get_position(struct ppu *ppu, uint16_t *scanline, uint16_t *dot);
+bool ppu_dots_until(struct ppu *ppu, uint16_t scanline, uint32_t *dots);
+void ppu_pop_bg_memo_stats(struct ppu *ppu, uint32_t *reused, uint32_t *fetched);
 
 // Configuration
 void ppu_set_config(struct ppu *ppu, const NES_Config *cfg);
+void ppu_set_debug(struct ppu *ppu, struct debug *dbg);
+
+// Observation
+bool ppu_set_observation(struct ppu *ppu, uint8_t *luma, uint16_t width, uint16_t height);
+size_t ppu_get_sprites(struct ppu *ppu, NES_Sprite *sprites, size_t max);
+
+// Conversion
+bool ppu_convert_frame(const NES_Frame *frame, NES_Palette palette, NES_PixelFormat format,
+	void *dst, size_t pitch);
 
 // Lifecycle
 struct ppu *ppu_create(const NES_Config *cfg);
@@ -8,11 +8,50 @@
 #include "cpu.h"
 #include "ppu.h"
 #include "apu.h"
+#include "debug.h"
+#include "ntsc.h"
 
 #define NES_LOG_MAX 1024
 
+// Cycles a CPU step may take: an instruction and an interrupt sequence, two OAM
+// transfers from a read-modify-write of $4014, and the DMC fetches around them
+#define SYS_STEP_MAX 2048
+
+// Bus accesses of the longest instruction followed by an interrupt sequence
+#define SYS_REPLAY_MAX 16
+
 static NES_LogCallback NES_LOG;
 
+// Per-cycle work instantiated for each mapper step mode and APU mixer, the
+// variant is selected when the cart or config changes
+#define SYS_LOOPS(X) \
+	X(SYS_LOOP_MONO,        false, APU_MIX_MONO,   apu_step_mono) \
+	X(SYS_LOOP_STEREO,      false, APU_MIX_STEREO, apu_step_stereo) \
+	X(SYS_LOOP_MASKED,      false, APU_MIX_MASKED, apu_step_masked) \
+	X(SYS_LOOP_STEP_MONO,   true,  APU_MIX_MONO,   apu_step_mono) \
+	X(SYS_LOOP_STEP_STEREO, true,  APU_MIX_STEREO, apu_step_stereo) \
+	X(SYS_LOOP_STEP_MASKED, true,  APU_MIX_MASKED, apu_step_masked)
+
+#define SYS_LOOP_ENUM(id, step, mixer, apu_fn) id,
+
+enum sys_loop {
+	SYS_LOOPS(SYS_LOOP_ENUM)
+};
+
+enum dma_oam {
+	DMA_OAM_HALT,
+	DMA_OAM_ALIGN,
+	DMA_OAM_READ,
+	DMA_OAM_WRITE,
+};
+
+enum replay_mode {
+	REPLAY_OFF,
+	REPLAY_RECORD,
+	REPLAY_STOPPED,
+	REPLAY_RESUME,
+};
+
 struct NES {
 	struct sys {
 		uint8_t ram[0x800];
@@ -21,14 +60,40 @@ struct NES {
 		uint64_t cycle_2007;
 		bool write;
 
+		// Transfers in progress resume where a stop cut them short
 		struct {
 			bool oam_begin;
 			bool dmc_begin;
 			bool oam;
+			bool oam_bulk;
+			bool dmc;
+			enum dma_oam oam_stage;
+			uint8_t oam_page;
+			uint8_t oam_value;
 			uint16_t oam_cycle;
+			uint64_t oam_start;
+			uint32_t oam_stolen; // DMC fetch cycles within the transfer, counted as DMC stalls
 			uint16_t dmc_addr;
 			uint8_t dmc_delay;
 		} dma;
+
+		// A CPU step close to the stop cycle records its bus accesses and the CPU after
+		// each. Cut short by the stop, it runs on without effect, then rolls back to the
+		// stop and is replayed from the record when emulation resumes.
+		struct replay {
+			enum replay_mode mode;
+			uint8_t n;
+			uint8_t pos;
+			uint64_t cycle;
+			uint8_t start[CPU_STATE_MAX];
+			uint8_t live[CPU_STATE_MAX];
+
+			struct {
+				uint8_t v;
+				uint64_t cycle;
+				uint8_t cpu[CPU_STATE_MAX];
+			} log[SYS_REPLAY_MAX];
+		} replay;
 	} sys;
 
 	struct ctrl {
@@ -39,10 +104,29 @@ struct NES {
 		uint8_t safe_buttons[4];
 	} ctrl;
 
+	// Counters for the frame in progress and the last completed frame
+	NES_FrameStats stats;
+	NES_FrameStats last_stats;
+	NES_FrameStats shadow_stats; // Written by a CPU step running past the stop
+	uint64_t frame_cycle;
+	bool frame_started;
+
 	struct cart *cart;
 	struct cpu *cpu;
 	struct ppu *ppu;
 	struct apu *apu;
+	struct debug *debug;
+	uint32_t instrument;
+	bool chr_cache;
+	enum sys_loop loop;
+	uint64_t cart_deadline; // Without a per-cycle step, the next cycle the mapper has to catch up on
+	uint64_t stop;          // Emulation halts on this cycle, even within an instruction or DMA
+
+	// Rows delivered to the slice callback in the frame in progress
+	NES_VideoCallback slice_callback;
+	void *slice_opaque;
+	uint16_t slice_lines;
+	uint16_t slice_row;
 };
 
 
@@ -105,16 +189,29 @@ static void ctrl_write(struct ctrl *ctrl, bool strobe)
 }
 
 
+// Mapper
+
+static void sys_sync_cart(NES *nes, uint64_t cycle)
+{
+	cart_sync(nes->cart, nes->cpu, cycle);
+	nes->cart_deadline = cart_get_deadline(nes->cart);
+}
+
+
 // IO
 // https://wiki.nesdev.com/w/index.php/CPU_memory_map
 
 uint8_t sys_read(NES *nes, uint16_t addr)
 {
+	if (nes->instrument & (NES_INSTRUMENT_HEATMAP | NES_INSTRUMENT_CDL))
+		debug_cpu_read(nes->debug, addr);
+
 	if (addr < 0x2000) {
 		return nes->sys.ram[addr % 0x0800];
 
 	} else if (addr < 0x4000) {
 		addr = 0x2000 + addr % 8;
+		nes->stats.ppuReads++;
 
 		// Double 2007 read glitch and mapper 185 copy protection
 		if (addr == 0x2007 && (nes->sys.cycle - nes->sys.cycle_2007 == 1 || cart_block_2007(nes->cart)))
@@ -132,6 +229,10 @@ uint8_t sys_read(NES *nes, uint16_t addr)
 		return nes->sys.open_bus;
 
 	} else if (addr >= 0x4020) {
+		// Mapper registers may read counters that catch up lazily
+		if (addr < 0x6000)
+			sys_sync_cart(nes, nes->sys.cycle);
+
 		bool hit = false;
 		uint8_t v = cart_prg_read(nes->cart, nes->apu, addr, &hit);
 
@@ -144,11 +245,15 @@ uint8_t sys_read(NES *nes, uint16_t addr)
 
 void sys_write(NES *nes, uint16_t addr, uint8_t v)
 {
+	if (nes->instrument & NES_INSTRUMENT_HEATMAP)
+		debug_cpu_write(nes->debug, addr);
+
 	if (addr < 0x2000) {
 		nes->sys.ram[addr % 0x800] = v;
 
 	} else if (addr < 0x4000) {
 		addr = 0x2000 + addr % 8;
+		nes->stats.ppuWrites++;
 
 		ppu_write(nes->ppu, nes->cart, addr, v);
 		cart_ppu_write_hook(nes->cart, addr, v); //MMC5 listens here
@@ -169,13 +274,132 @@ void sys_write(NES *nes, uint16_t addr, uint8_t v)
 		nes->sys.open_bus = v;
 
 	} else {
+		// Mapper register writes may change what the PPU fetches or reschedule an IRQ,
+		// work RAM writes can do neither and leave a deferred line to render at once
+		if (!cart_prg_is_ram(nes->cart, addr)) {
+			nes->stats.mapperWrites++;
+			ppu_sync(nes->ppu, nes->cart);
+			sys_sync_cart(nes, nes->sys.cycle);
+		}
+
 		cart_prg_write(nes->cart, nes->apu, addr, v);
+		nes->cart_deadline = cart_get_deadline(nes->cart);
 	}
 }
 
 
 // DMA
 
+static void sys_idle_cycle(NES *nes);
+static uint8_t sys_bus_read(NES *nes, uint16_t addr);
+static void sys_bus_write(NES *nes, uint16_t addr, uint8_t v);
+
+static bool sys_at_stop(NES *nes)
+{
+	return nes->sys.cycle >= nes->stop;
+}
+
+static bool sys_dma_oam_bulk(NES *nes, uint8_t page)
+{
+	// When nothing can observe the transfer in progress, the page is copied at once
+	// and the 512 cycles run without bus access. Reads must be free of side effects,
+	// no DMC DMA may interleave, and the PPU must stay out of rendering.
+	if (nes->instrument & (NES_INSTRUMENT_HEATMAP | NES_INSTRUMENT_CDL))
+		return false;
+
+	if (page >= 0x20 && (page < 0x60 || cart_has_prg_hooks(nes->cart)))
+		return false;
+
+	if (nes->sys.dma.dmc_begin || !apu_dmc_idle(nes->apu) || !ppu_oam_idle(nes->ppu, 512 * 3))
+		return false;
+
+	uint8_t data[256];
+
+	for (uint16_t x = 0; x < 256; x++) {
+		uint16_t addr = page * 0x0100 + x;
+
+		if (addr < 0x2000) {
+			data[x] = nes->sys.ram[addr % 0x0800];
+
+		} else {
+			bool hit = false;
+			uint8_t v = cart_read(nes->cart, PRG, addr, &hit);
+			data[x] = hit ? v : nes->sys.open_bus;
+		}
+	}
+
+	ppu_write_oam(nes->ppu, nes->cart, data);
+
+	for (uint16_t x = 0; x < 256; x++)
+		cart_ppu_write_hook(nes->cart, 0x2004, data[x]);
+
+	nes->stats.ppuWrites += 256;
+
+	return true;
+}
+
+static void sys_dma_oam_copy(NES *nes)
+{
+	nes->sys.dma.oam_bulk = sys_dma_oam_bulk(nes, nes->sys.dma.oam_page);
+	nes->sys.dma.oam_cycle = 0;
+	nes->sys.dma.oam_stage = DMA_OAM_READ;
+}
+
+static void sys_dma_oam_run(NES *nes)
+{
+	while (nes->sys.dma.oam && !sys_at_stop(nes)) {
+		switch (nes->sys.dma.oam_stage) {
+			case DMA_OAM_HALT:
+				sys_cycle(nes); // +1 default case
+
+				if (sys_odd_cycle(nes)) {
+					nes->sys.dma.oam_stage = DMA_OAM_ALIGN;
+
+				} else {
+					sys_dma_oam_copy(nes);
+				}
+				break;
+
+			case DMA_OAM_ALIGN:
+				sys_cycle(nes); // +1 if odd cycle
+				sys_dma_oam_copy(nes);
+				break;
+
+			// +512 read/write, idle after a bulk copy
+			case DMA_OAM_READ:
+				if (nes->sys.dma.oam_bulk) {
+					sys_idle_cycle(nes);
+
+				} else {
+					nes->sys.dma.oam_value = sys_bus_read(nes,
+						nes->sys.dma.oam_page * 0x0100 + nes->sys.dma.oam_cycle);
+				}
+
+				nes->sys.dma.oam_stage = DMA_OAM_WRITE;
+				break;
+
+			case DMA_OAM_WRITE:
+				if (nes->sys.dma.oam_bulk) {
+					sys_idle_cycle(nes);
+
+				} else {
+					sys_bus_write(nes, 0x2014, nes->sys.dma.oam_value);
+				}
+
+				nes->sys.dma.oam_stage = DMA_OAM_READ;
+
+				if (++nes->sys.dma.oam_cycle == 256) {
+					cpu_halt(nes->cpu, false);
+					nes->sys.dma.oam = false;
+
+					nes->stats.oamDMACycles += (uint32_t) (nes->sys.cycle - nes->sys.dma.oam_start) -
+						nes->sys.dma.oam_stolen;
+				}
+				break;
+		}
+	}
+}
+
 static void sys_dma_oam(NES *nes, uint8_t v)
 {
 	// https://forums.nesdev.com/viewtopic.php?f=3&t=6100
@@ -185,19 +409,13 @@ static void sys_dma_oam(NES *nes, uint8_t v)
 
 	nes->sys.dma.oam_begin = false;
 	nes->sys.dma.oam = true;
+	nes->sys.dma.oam_stage = DMA_OAM_HALT;
+	nes->sys.dma.oam_page = v;
+	nes->sys.dma.oam_start = nes->sys.cycle;
+	nes->sys.dma.oam_stolen = 0;
 	cpu_halt(nes->cpu, true);
 
-	sys_cycle(nes); // +1 default case
-
-	if (sys_odd_cycle(nes)) // +1 if odd cycle
-		sys_cycle(nes);
-
-	// +512 read/write
-	for (nes->sys.dma.oam_cycle = 0; nes->sys.dma.oam_cycle < 256; nes->sys.dma.oam_cycle++)
-		sys_write_cycle(nes, 0x2014, sys_read_cycle(nes, v * 0x0100 + nes->sys.dma.oam_cycle));
-
-	cpu_halt(nes->cpu, false);
-	nes->sys.dma.oam = false;
+	sys_dma_oam_run(nes);
 }
 
 void sys_dma_dmc_begin(NES *nes, uint16_t addr)
@@ -223,6 +441,27 @@ void sys_dma_dmc_begin(NES *nes, uint16_t addr)
 	}
 }
 
+static void sys_dma_dmc_run(NES *nes)
+{
+	for (; nes->sys.dma.dmc_delay > 0; nes->sys.dma.dmc_delay--) {
+		if (sys_at_stop(nes))
+			return;
+
+		sys_cycle(nes);
+	}
+
+	if (sys_at_stop(nes))
+		return;
+
+	if (nes->instrument & NES_INSTRUMENT_CDL)
+		debug_cpu_dmc(nes->debug, nes->sys.dma.dmc_addr);
+
+	apu_dma_dmc_finish(nes->apu, sys_bus_read(nes, nes->sys.dma.dmc_addr));
+
+	cpu_halt(nes->cpu, false);
+	nes->sys.dma.dmc = false;
+}
+
 static uint8_t sys_dma_dmc(NES *nes, uint16_t addr, uint8_t v)
 {
 	if (!nes->sys.dma.dmc_begin)
@@ -233,25 +472,91 @@ static uint8_t sys_dma_dmc(NES *nes, uint16_t addr, uint8_t v)
 		ppu_read(nes->ppu, nes->cart, addr);
 	}
 
+	// The halted CPU repeats its read, the CDL already classified it
+	if (nes->instrument & NES_INSTRUMENT_CDL)
+		debug_cpu_dummy(nes->debug);
+
 	v = sys_read(nes, addr);
 
 	nes->sys.dma.dmc_begin = false;
-	cpu_halt(nes->cpu, true);
+	nes->sys.dma.dmc = true;
+	nes->stats.dmcDMACycles += nes->sys.dma.dmc_delay + 1;
 
-	for (uint8_t x = 0; x < nes->sys.dma.dmc_delay; x++)
-		sys_cycle(nes);
+	if (nes->sys.dma.oam)
+		nes->sys.dma.oam_stolen += nes->sys.dma.dmc_delay + 1;
 
-	apu_dma_dmc_finish(nes->apu, sys_read_cycle(nes, nes->sys.dma.dmc_addr));
+	cpu_halt(nes->cpu, true);
 
-	cpu_halt(nes->cpu, false);
+	sys_dma_dmc_run(nes);
 
 	return v;
 }
 
+static void sys_dma_resume(NES *nes)
+{
+	// A DMC fetch cut short within an OAM transfer finishes first
+	if (nes->sys.dma.dmc)
+		sys_dma_dmc_run(nes);
+
+	sys_dma_oam_run(nes);
+}
+
 
 // Step
 
-uint8_t sys_read_cycle(NES *nes, uint16_t addr)
+static FORCE_INLINE void sys_step_cart(NES *nes, bool step)
+{
+	if (step) {
+		cart_step(nes->cart, nes->cpu, nes->apu);
+
+	} else if (nes->sys.cycle >= nes->cart_deadline) {
+		sys_sync_cart(nes, nes->sys.cycle + 1);
+	}
+}
+
+static FORCE_INLINE void sys_tick(NES *nes)
+{
+	#define SYS_TICK(id, step, mixer, apu_fn) \
+		case id: \
+			sys_step_cart(nes, step); \
+			cpu_poll_interrupts(nes->cpu); \
+			apu_fn(nes->apu, nes); \
+			break;
+
+	switch (nes->loop) {
+		SYS_LOOPS(SYS_TICK)
+	}
+
+	apu_assert_irqs(nes->apu, nes->cpu);
+}
+
+static void sys_select_loop(NES *nes)
+{
+	bool step = cart_has_step(nes->cart);
+	enum apu_mixer mixer = apu_get_mixer(nes->apu);
+
+	#define SYS_SELECT(id, id_step, id_mixer, apu_fn) \
+		if (step == id_step && mixer == id_mixer) \
+			nes->loop = id;
+
+	SYS_LOOPS(SYS_SELECT)
+}
+
+static void sys_idle_cycle(NES *nes)
+{
+	// A cycle with the CPU halted and the bus unused
+	ppu_step(nes->ppu, nes->cart);
+	ppu_step(nes->ppu, nes->cart);
+	ppu_assert_nmi(nes->ppu, nes->cpu);
+
+	sys_tick(nes);
+
+	nes->sys.cycle++;
+
+	ppu_step(nes->ppu, nes->cart);
+}
+
+static uint8_t sys_bus_read(NES *nes, uint16_t addr)
 {
 	ppu_step(nes->ppu, nes->cart);
 
@@ -260,11 +565,7 @@ uint8_t sys_read_cycle(NES *nes, uint16_t addr)
 	ppu_step(nes->ppu, nes->cart);
 	ppu_assert_nmi(nes->ppu, nes->cpu);
 
-	cart_step(nes->cart, nes->cpu, nes->apu);
-	cpu_poll_interrupts(nes->cpu);
-
-	apu_step(nes->apu, nes);
-	apu_assert_irqs(nes->apu, nes->cpu);
+	sys_tick(nes);
 
 	nes->sys.cycle++;
 
@@ -274,7 +575,7 @@ uint8_t sys_read_cycle(NES *nes, uint16_t addr)
 	return sys_dma_dmc(nes, addr, v);
 }
 
-void sys_write_cycle(NES *nes, uint16_t addr, uint8_t v)
+static void sys_bus_write(NES *nes, uint16_t addr, uint8_t v)
 {
 	// DMC DMA will only engage on a read cycle, double writes will stall longer
 	if (nes->sys.dma.dmc_begin)
@@ -288,11 +589,7 @@ void sys_write_cycle(NES *nes, uint16_t addr, uint8_t v)
 	ppu_step(nes->ppu, nes->cart);
 	ppu_assert_nmi(nes->ppu, nes->cpu);
 
-	cart_step(nes->cart, nes->cpu, nes->apu);
-	cpu_poll_interrupts(nes->cpu);
-
-	apu_step(nes->apu, nes);
-	apu_assert_irqs(nes->apu, nes->cpu);
+	sys_tick(nes);
 
 	nes->sys.cycle++;
 	nes->sys.write = false;
@@ -303,9 +600,70 @@ void sys_write_cycle(NES *nes, uint16_t addr, uint8_t v)
 	sys_dma_oam(nes, v);
 }
 
+static uint8_t sys_replay_cycle(NES *nes, uint16_t addr, uint8_t v, bool write)
+{
+	struct replay *r = &nes->sys.replay;
+
+	switch (r->mode) {
+		case REPLAY_RECORD:
+			if (write) {
+				sys_bus_write(nes, addr, v);
+
+			} else {
+				v = sys_bus_read(nes, addr);
+			}
+
+			r->log[r->n].v = v;
+			r->log[r->n].cycle = nes->sys.cycle;
+			cpu_get_state(nes->cpu, r->log[r->n].cpu, CPU_STATE_MAX);
+			r->n++;
+
+			if (sys_at_stop(nes))
+				r->mode = REPLAY_STOPPED;
+
+			return v;
+
+		// The interrupt lines seen after each access are part of the record, the last
+		// access hands over to the lines the system has advanced since the stop
+		case REPLAY_RESUME:
+			v = r->log[r->pos++].v;
+
+			if (r->pos < r->n) {
+				cpu_set_state(nes->cpu, r->log[r->pos - 1].cpu, CPU_STATE_MAX);
+
+			} else {
+				cpu_set_state(nes->cpu, r->live, CPU_STATE_MAX);
+				r->mode = REPLAY_RECORD;
+			}
+
+			return v;
+
+		default:
+			return 0;
+	}
+}
+
+uint8_t sys_read_cycle(NES *nes, uint16_t addr)
+{
+	if (nes->sys.replay.mode == REPLAY_OFF)
+		return sys_bus_read(nes, addr);
+
+	return sys_replay_cycle(nes, addr, 0, false);
+}
+
+void sys_write_cycle(NES *nes, uint16_t addr, uint8_t v)
+{
+	if (nes->sys.replay.mode == REPLAY_OFF) {
+		sys_bus_write(nes, addr, v);
+
+	} else {
+		sys_replay_cycle(nes, addr, v, true);
+	}
+}
+
 void sys_cycle(NES *nes)
 {
-	sys_read_cycle(nes, 0);
+	sys_bus_read(nes, 0);
 }
 
 bool sys_odd_cycle(NES *nes)
@@ -313,6 +671,59 @@ bool sys_odd_cycle(NES *nes)
 	return nes->sys.cycle & 1;
 }
 
+uint64_t sys_get_cycle(NES *nes)
+{
+	struct replay *r = &nes->sys.replay;
+
+	// Replayed accesses report the cycle they originally ran on
+	if (r->mode == REPLAY_RESUME)
+		return r->pos > 0 ? r->log[r->pos - 1].cycle : r->cycle;
+
+	return nes->sys.cycle;
+}
+
+
+// Instrumentation
+
+NES_FrameStats *sys_stats(NES *nes)
+{
+	return nes->sys.replay.mode == REPLAY_STOPPED ? &nes->shadow_stats : &nes->stats;
+}
+
+static void sys_set_instrument(NES *nes, uint32_t flags)
+{
+	// Instruments debug failed to allocate for come back cleared
+	nes->instrument = flags;
+
+	ppu_set_debug(nes->ppu, (flags & (NES_INSTRUMENT_HEATMAP | NES_INSTRUMENT_CDL)) ? nes->debug : NULL);
+}
+
+struct debug *sys_debug(NES *nes)
+{
+	// Events past the stop are reported once the step is replayed
+	if (nes->sys.replay.mode >= REPLAY_STOPPED)
+		return NULL;
+
+	return nes->instrument ? nes->debug : NULL;
+}
+
+uint8_t sys_peek(NES *nes, uint16_t addr)
+{
+	// Side effect free read of memory, registers are not peeked
+	if (addr < 0x2000)
+		return nes->sys.ram[addr % 0x800];
+
+	if (addr >= 0x4020 && nes->cart)
+		return cart_read(nes->cart, PRG, addr, NULL);
+
+	return nes->sys.open_bus;
+}
+
+void sys_get_ppu_position(NES *nes, uint16_t *scanline, uint16_t *dot)
+{
+	ppu_get_position(nes->ppu, scanline, dot);
+}
+
 
 // Cart
 
@@ -320,11 +731,16 @@ bool NES_LoadCart(NES *ctx, const void *rom, size_t romSize, const NES_CartDesc
 {
 	cart_destroy(&ctx->cart);
 
-	if (rom) {
+	if (rom)
 		ctx->cart = cart_create(rom, romSize, hdr);
-		if (ctx->cart)
-			NES_Reset(ctx, true);
-	}
+
+	if (ctx->cart)
+		cart_set_chr_cache(ctx->cart, ctx->chr_cache);
+
+	sys_set_instrument(ctx, debug_reset(ctx->debug, ctx->cart));
+
+	if (ctx->cart)
+		NES_Reset(ctx, true);
 
 	return ctx->cart ? true : false;
 }
@@ -341,11 +757,16 @@ bool NES_LoadDisks(NES *ctx, const void *bios, size_t biosSize, const void *disk
 {
 	cart_destroy(&ctx->cart);
 
-	if (bios && disks) {
+	if (bios && disks)
 		ctx->cart = cart_fds_create(bios, biosSize, disks, disksSize);
-		if (ctx->cart)
-			NES_Reset(ctx, true);
-	}
+
+	if (ctx->cart)
+		cart_set_chr_cache(ctx->cart, ctx->chr_cache);
+
+	sys_set_instrument(ctx, debug_reset(ctx->debug, ctx->cart));
+
+	if (ctx->cart)
+		NES_Reset(ctx, true);
 
 	return ctx->cart ? true : false;
 }
@@ -377,35 +798,308 @@ uint8_t NES_GetNumDisks(NES *ctx)
 
 // Step
 
-uint32_t NES_NextFrame(NES *ctx, NES_VideoCallback videoCallback,
-	NES_AudioCallback audioCallback, void *opaque)
+static void sys_deliver_slice(NES *ctx, bool frame_done)
 {
-	if (!ctx->cart)
-		return 0;
+	uint16_t rows_done = ppu_rows_done(ctx->ppu);
 
-	uint64_t cycles = ctx->sys.cycle;
-	bool cpu_ok = true;
+	// Rows restart after a reset in the middle of a frame
+	if (rows_done < ctx->slice_row)
+		ctx->slice_row = 0;
 
-	while (cpu_ok && !ppu_new_frame(ctx->ppu)) {
-		cpu_ok = cpu_step(ctx->cpu, ctx);
+	uint16_t rows = rows_done - ctx->slice_row;
 
-		// Fire audio callback in batches for lower latency
-		uint32_t count = apu_num_frames(ctx->apu);
+	if (rows >= ctx->slice_lines || (frame_done && rows > 0)) {
+		NES_Frame slice;
+		ppu_get_slice(ctx->ppu, ctx->slice_row, rows, &slice);
+		slice.cycle = ctx->sys.cycle;
 
-		if (count > 0)
-			audioCallback(apu_pop_frames(ctx->apu), count, opaque);
+		ctx->slice_callback(&slice, ctx->slice_opaque);
+		ctx->slice_row = rows_done;
 	}
+}
+
+static bool sys_step_cpu(NES *ctx)
+{
+	struct replay *r = &ctx->sys.replay;
+
+	if (r->mode == REPLAY_STOPPED) {
+		// DMA cut short by the stop finishes first, the step then replays its bus
+		// accesses up to the stop and carries on from there
+		sys_dma_resume(ctx);
 
-	if (!cpu_ok) {
-		NES_LoadCart(ctx, NULL, 0, NULL);
+		if (sys_at_stop(ctx))
+			return true;
+
+		cpu_get_state(ctx->cpu, r->live, CPU_STATE_MAX);
+		cpu_set_state(ctx->cpu, r->start, CPU_STATE_MAX);
+		r->mode = REPLAY_RESUME;
+		r->pos = 0;
+
+	} else if (ctx->stop - ctx->sys.cycle > SYS_STEP_MAX) {
+		ctx->stats.instructions++;
+
+		return cpu_step(ctx->cpu, ctx);
 
 	} else {
-		videoCallback(ppu_pixels(ctx->ppu), opaque);
+		r->mode = REPLAY_RECORD;
+		r->n = 0;
+		r->cycle = ctx->sys.cycle;
+		cpu_get_state(ctx->cpu, r->start, CPU_STATE_MAX);
 	}
 
+	bool cpu_ok = cpu_step(ctx->cpu, ctx);
+
+	// The CPU ran on past the stop, it goes back to where the stop left it
+	if (r->mode == REPLAY_STOPPED) {
+		cpu_set_state(ctx->cpu, r->log[r->n - 1].cpu, CPU_STATE_MAX);
+
+	} else {
+		r->mode = REPLAY_OFF;
+		ctx->stats.instructions++;
+	}
+
+	return cpu_ok;
+}
+
+static void sys_begin_frame(NES *ctx)
+{
+	ctx->frame_cycle = ctx->sys.cycle;
+	ctx->frame_started = true;
+
+	memset(&ctx->stats, 0, sizeof(NES_FrameStats));
+
+	if (ctx->instrument)
+		debug_frame(ctx->debug);
+}
+
+static void sys_end_frame(NES *ctx)
+{
+	ctx->stats.cycles = (uint32_t) (ctx->sys.cycle - ctx->frame_cycle);
+	ctx->stats.bankSwitches = cart_pop_bank_switches(ctx->cart);
+	ppu_pop_bg_memo_stats(ctx->ppu, &ctx->stats.bgRowsReused, &ctx->stats.bgRowsFetched);
+	debug_pop_handler_cycles(ctx->debug, &ctx->stats.nmiHandlerCycles, &ctx->stats.irqHandlerCycles);
+	ctx->stats.traceDropped = debug_pop_trace_dropped(ctx->debug);
+	ctx->last_stats = ctx->stats;
+	ctx->frame_started = false;
+}
+
+static uint32_t sys_run(NES *ctx, uint64_t stop, bool frame, NES_VideoCallback videoCallback,
+	NES_AudioCallback audioCallback, void *opaque)
+{
+	uint64_t cycles = ctx->sys.cycle;
+	bool cpu_ok = true;
+
+	ctx->stop = stop;
+
+	while (true) {
+		if (!ctx->frame_started)
+			sys_begin_frame(ctx);
+
+		while (cpu_ok && !sys_at_stop(ctx) && !ppu_new_frame(ctx->ppu)) {
+			cpu_ok = sys_step_cpu(ctx);
+
+			// Fire audio callback in batches for lower latency
+			uint32_t count = apu_num_frames(ctx->apu);
+
+			if (count > 0) {
+				ctx->stats.audioFrames += count;
+				audioCallback(apu_pop_frames(ctx->apu), count, opaque);
+			}
+
+			if (ctx->slice_callback)
+				sys_deliver_slice(ctx, false);
+		}
+
+		if (!cpu_ok) {
+			sys_end_frame(ctx);
+			NES_LoadCart(ctx, NULL, 0, NULL);
+			break;
+		}
+
+		if (!ppu_new_frame(ctx->ppu))
+			break;
+
+		sys_end_frame(ctx);
+
+		if (ctx->slice_callback)
+			sys_deliver_slice(ctx, true);
+
+		NES_Frame out;
+		ppu_get_frame(ctx->ppu, &out);
+		out.cycle = ctx->sys.cycle;
+		ctx->slice_row = 0;
+
+		videoCallback(&out, opaque);
+		ppu_next_buffer(ctx->ppu);
+
+		if (frame)
+			break;
+	}
+
+	ctx->stop = UINT64_MAX;
+
 	return (uint32_t) (ctx->sys.cycle - cycles);
 }
 
+uint32_t NES_NextFrame(NES *ctx, NES_VideoCallback videoCallback,
+	NES_AudioCallback audioCallback, void *opaque)
+{
+	if (!ctx->cart)
+		return 0;
+
+	return sys_run(ctx, UINT64_MAX, true, videoCallback, audioCallback, opaque);
+}
+
+uint32_t NES_RunCycles(NES *ctx, uint32_t cycles, NES_VideoCallback videoCallback,
+	NES_AudioCallback audioCallback, void *opaque)
+{
+	if (!ctx->cart)
+		return 0;
+
+	// Stops exactly, within an instruction or DMA transfer if need be. Frames
+	// completed on the way are delivered to the video callback.
+	return sys_run(ctx, ctx->sys.cycle + cycles, false, videoCallback, audioCallback, opaque);
+}
+
+uint32_t NES_RunUntilScanline(NES *ctx, uint16_t scanline, NES_VideoCallback videoCallback,
+	NES_AudioCallback audioCallback, void *opaque)
+{
+	if (!ctx->cart)
+		return 0;
+
+	// Stops on the first cycle the PPU is on the scanline, three dots per cycle. The
+	// distance may be one dot long for odd frames, leaving the run one cycle short.
+	uint32_t dots = 0;
+	if (!ppu_dots_until(ctx->ppu, scanline, &dots))
+		return 0;
+
+	uint32_t cycles = sys_run(ctx, ctx->sys.cycle + (dots + 2) / 3, false, videoCallback, audioCallback, opaque);
+
+	if (ctx->cart && ppu_dots_until(ctx->ppu, scanline, &dots) && dots <= 3)
+		cycles += sys_run(ctx, ctx->sys.cycle + 1, false, videoCallback, audioCallback, opaque);
+
+	return cycles;
+}
+
+void NES_SetSliceCallback(NES *ctx, NES_VideoCallback sliceCallback, uint16_t lines, void *opaque)
+{
+	ctx->slice_callback = lines > 0 ? sliceCallback : NULL;
+	ctx->slice_opaque = opaque;
+	ctx->slice_lines = lines;
+}
+
+
+// Video
+
+bool NES_ConvertFrame(const NES_Frame *frame, NES_Palette palette, NES_PixelFormat format,
+	void *dst, size_t pitch)
+{
+	return ppu_convert_frame(frame, palette, format, dst, pitch);
+}
+
+bool NES_AcquireFrame(NES *ctx, const NES_Frame *frame)
+{
+	return ppu_acquire_frame(ctx->ppu, frame->pixels);
+}
+
+void NES_ReleaseFrame(NES *ctx, const NES_Frame *frame)
+{
+	ppu_release_frame(ctx->ppu, frame->pixels);
+}
+
+
+// NTSC
+
+NES_NTSC *NES_CreateNTSC(uint32_t width)
+{
+	return ntsc_create(width);
+}
+
+void NES_DestroyNTSC(NES_NTSC **ntsc)
+{
+	ntsc_destroy(ntsc);
+}
+
+bool NES_FilterNTSC(NES_NTSC *ntsc, const NES_Frame *frame, uint32_t y, uint32_t height,
+	void *dst, size_t pitch)
+{
+	return ntsc_filter(ntsc, frame, y, height, dst, pitch);
+}
+
+
+// Observation
+
+bool NES_SetObservation(NES *ctx, uint8_t *luma, uint16_t width, uint16_t height)
+{
+	return ppu_set_observation(ctx->ppu, luma, width, height);
+}
+
+size_t NES_GetSprites(NES *ctx, NES_Sprite *sprites, size_t max)
+{
+	return ppu_get_sprites(ctx->ppu, sprites, max);
+}
+
+const uint8_t *NES_GetRAM(NES *ctx)
+{
+	return ctx->sys.ram;
+}
+
+
+// Stats
+
+void NES_GetFrameStats(NES *ctx, NES_FrameStats *stats)
+{
+	*stats = ctx->last_stats;
+}
+
+
+// Instrumentation
+
+void NES_SetInstrumentation(NES *ctx, uint32_t flags)
+{
+	sys_set_instrument(ctx, debug_set_flags(ctx->debug, flags));
+}
+
+size_t NES_GetProfile(NES *ctx, NES_ProfileEntry *entries, size_t max)
+{
+	return debug_get_profile(ctx->debug, entries, max);
+}
+
+size_t NES_GetProfileStacks(NES *ctx, char *buf, size_t size)
+{
+	return debug_get_profile_stacks(ctx->debug, buf, size);
+}
+
+bool NES_GetHeatmap(NES *ctx, NES_Heatmap *heatmap, bool cumulative)
+{
+	return debug_get_heatmap(ctx->debug, heatmap, cumulative);
+}
+
+void NES_SetTraceTrigger(NES *ctx, uint16_t pcStart, uint16_t pcEnd, uint32_t frameStart, uint32_t frameEnd)
+{
+	debug_set_trace_trigger(ctx->debug, pcStart, pcEnd, frameStart, frameEnd);
+}
+
+size_t NES_ReadTrace(NES *ctx, NES_TraceEntry *entries, size_t max)
+{
+	return debug_read_trace(ctx->debug, entries, max);
+}
+
+size_t NES_FormatTrace(const NES_TraceEntry *entry, char *buf, size_t size)
+{
+	return debug_format_trace(entry, buf, size);
+}
+
+size_t NES_GetCDLSize(NES *ctx)
+{
+	return debug_get_cdl_size(ctx->debug);
+}
+
+bool NES_GetCDL(NES *ctx, void *cdl, size_t size)
+{
+	return debug_get_cdl(ctx->debug, cdl, size);
+}
+
 
 // Input
 
@@ -422,8 +1116,20 @@ void NES_ControllerState(NES *nes, uint8_t player, uint8_t state)
 
 void NES_SetConfig(NES *ctx, const NES_Config *cfg)
 {
+	if (ctx->cart) {
+		ppu_sync(ctx->ppu, ctx->cart);
+
+		if (cfg->chrCache != ctx->chr_cache)
+			cart_set_chr_cache(ctx->cart, cfg->chrCache);
+	}
+
+	ctx->chr_cache = cfg->chrCache;
+
 	apu_set_config(ctx->apu, cfg);
 	ppu_set_config(ctx->ppu, cfg);
+
+	if (ctx->cart)
+		sys_select_loop(ctx);
 }
 
 
@@ -449,6 +1155,9 @@ NES *NES_Create(const NES_Config *cfg)
 	ctx->cpu = cpu_create();
 	ctx->ppu = ppu_create(cfg);
 	ctx->apu = apu_create(cfg);
+	ctx->debug = debug_create(ctx);
+	ctx->chr_cache = cfg->chrCache;
+	ctx->stop = UINT64_MAX;
 
 	return ctx;
 }
@@ -460,6 +1169,7 @@ void NES_Destroy(NES **nes)
 
 	NES *ctx = *nes;
 
+	debug_destroy(&ctx->debug);
 	apu_destroy(&ctx->apu);
 	ppu_destroy(&ctx->ppu);
 	cpu_destroy(&ctx->cpu);
@@ -479,12 +1189,24 @@ void NES_Reset(NES *ctx, bool hard)
 	memset(&ctx->sys, 0, sizeof(struct sys));
 	memset(&ctx->ctrl, 0, sizeof(struct ctrl));
 
+	// A frame begun by NES_RunCycles doesn't span the reset, the next run starts afresh
+	memset(&ctx->stats, 0, sizeof(NES_FrameStats));
+	ctx->frame_started = false;
+
 	if (!hard) {
 		memcpy(ctx->sys.ram, prev.ram, 0x800);
+
+		// Mapper counters keep running, their clock restarts with the system's
+		cart_sync(ctx->cart, ctx->cpu, prev.cycle);
+		cart_set_clock(ctx->cart, 0);
+
 	} else {
 		cart_reset(ctx->cart);
 	}
 
+	sys_select_loop(ctx);
+	ctx->cart_deadline = cart_get_deadline(ctx->cart);
+
 	ppu_reset(ctx->ppu);
 	apu_reset(ctx->apu, ctx, hard);
 	cpu_reset(ctx->cpu, ctx, hard);
@@ -515,6 +1237,10 @@ static bool sys_get_state(struct sys *sys, void *state, size_t size)
 
 	memcpy(state, sys, sizeof(struct sys));
 
+	// Outside of a stopped step the record is stale
+	if (sys->replay.mode == REPLAY_OFF)
+		memset((uint8_t *) state + offsetof(struct sys, replay), 0, sizeof(struct replay));
+
 	return true;
 }
 
@@ -598,10 +1324,15 @@ bool NES_SetState(NES *ctx, const void *state, size_t size)
 	s8 += cart_get_state_size(ctx->cart);
 	size -= cart_get_state_size(ctx->cart);
 
+	ctx->cart_deadline = cart_get_deadline(ctx->cart);
+
 	r = sys_set_state(&ctx->sys, s8, size);
 	if (!r)
 		goto except;
 
+	memset(&ctx->stats, 0, sizeof(NES_FrameStats));
+	ctx->frame_started = false;
+
 	s8 += sys_get_state_size();
 	size -= sys_get_state_size();
 
@@ -627,6 +1358,8 @@ bool NES_GetState(NES *ctx, void *state, size_t size)
 	if (!ctx->cart)
 		return false;
 
+	ppu_sync(ctx->ppu, ctx->cart);
+
 	uint8_t *s8 = state;
 
 	if (!cpu_get_state(ctx->cpu, s8, size))
@@ -8,6 +8,23 @@
 #define GET_FLAG(reg, flag)   ((reg) & (flag))
 #define UNSET_FLAG(reg, flag) ((reg) &= ~(flag))
 
+// Single producer, single consumer handoff between the emulation thread and a reader
+#if defined(_MSC_VER)
+	#include <intrin.h>
+	#define ATOMIC_LOAD(ptr)     ((uint32_t) _InterlockedOr((volatile long *) (ptr), 0))
+	#define ATOMIC_STORE(ptr, v) _InterlockedExchange((volatile long *) (ptr), (long) (v))
+#else
+	#define ATOMIC_LOAD(ptr)     __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+	#define ATOMIC_STORE(ptr, v) __atomic_store_n((ptr), (v), __ATOMIC_RELEASE)
+#endif
+
+// Bodies instantiated per variant, so that their constant arguments fold away
+#if defined(_MSC_VER)
+	#define FORCE_INLINE __forceinline
+#else
+	#define FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
 // IO
 uint8_t sys_read(NES *nes, uint16_t addr);
 void sys_write(NES *nes, uint16_t addr, uint8_t v);
@@ -18,3 +35,10 @@ uint8_t sys_read_cycle(NES *nes, uint16_t addr);
 void sys_write_cycle(NES *nes, uint16_t addr, uint8_t v);
 void sys_cycle(NES *nes);
 bool sys_odd_cycle(NES *nes);
+uint64_t sys_get_cycle(NES *nes);
+
+// Instrumentation
+NES_FrameStats *sys_stats(NES *nes);
+struct debug *sys_debug(NES *nes);
+uint8_t sys_peek(NES *nes, uint16_t addr);
+void sys_get_ppu_position(NES *nes, uint16_t *scanline, uint16_t *dot);